@@ -0,0 +1,302 @@
+// c++ -std=c++17 -O2 bench.cpp -o bench -I/usr/local/include -L/usr/local/lib -lassimp -pthread -Wall
+
+/// Times the rig path of converter.cpp (save_rig(), verify_skinning(), and the TGF, DMAT, SKIN, and .rig writers)
+/// on procedurally generated rigged scenes, so that performance changes can be compared.
+/// No input files are needed; the scenes are built in memory.
+
+#define CONVERTER_NO_MAIN
+#include "converter.cpp"
+
+#include <random>
+#include <cstdlib> // atoi
+#include <unistd.h> // unlink, rmdir
+
+namespace
+{
+struct SceneSize
+{
+    int meshes;
+    int vertices_per_mesh;
+    int bones;
+    // The length of the longest chain of bones below the root.
+    int depth;
+    int influences_per_vertex;
+};
+
+aiNode* new_node( const std::string& name, aiNode* parent, const aiVector3D& translation )
+{
+    aiNode* node = new aiNode();
+    node->mName.Set( name );
+    node->mParent = parent;
+    node->mTransformation.a4 = translation.x;
+    node->mTransformation.b4 = translation.y;
+    node->mTransformation.c4 = translation.z;
+    return node;
+}
+
+void set_children( aiNode* node, const std::vector< aiNode* >& children )
+{
+    node->mNumChildren = children.size();
+    node->mChildren = new aiNode*[ children.size() ];
+    std::copy( children.begin(), children.end(), node->mChildren );
+}
+
+aiScene* make_rigged_scene( const SceneSize& size, unsigned int seed = 0 )
+{
+    /*
+    Returns a new scene with `size.meshes` meshes of `size.vertices_per_mesh` vertices each,
+    skinned to `size.bones` bones. The bones are chains of `size.depth` bones hanging off the root,
+    and every vertex has `size.influences_per_vertex` distinct bones with weights summing to 1.
+    The same `size` and `seed` always make the same scene.
+    */
+    
+    assert( size.bones >= size.influences_per_vertex );
+    assert( size.depth >= 1 );
+    
+    std::mt19937 generator( seed );
+    std::uniform_real_distribution< float > uniform( 0.f, 1.f );
+    
+    aiScene* scene = new aiScene();
+    
+    /// The hierarchy: root -> chains of bones.
+    aiNode* root = new_node( "root", nullptr, aiVector3D( 0, 0, 0 ) );
+    std::vector< aiNode* > root_children;
+    std::vector< aiNode* > bone_nodes;
+    for( int bone = 0; bone < size.bones; ++bone ) {
+        const bool starts_chain = 0 == bone % size.depth;
+        aiNode* parent = starts_chain ? root : bone_nodes.back();
+        aiNode* node = new_node( "bone" + std::to_string( bone ), parent, aiVector3D( uniform( generator ), 1.f, uniform( generator ) ) );
+        if( starts_chain ) root_children.push_back( node );
+        else set_children( parent, std::vector< aiNode* >( 1, node ) );
+        bone_nodes.push_back( node );
+    }
+    set_children( root, root_children );
+    scene->mRootNode = root;
+    
+    /// The meshes.
+    scene->mNumMeshes = size.meshes;
+    scene->mMeshes = new aiMesh*[ size.meshes ];
+    for( int mesh_index = 0; mesh_index < size.meshes; ++mesh_index ) {
+        aiMesh* mesh = new aiMesh();
+        mesh->mNumVertices = size.vertices_per_mesh;
+        mesh->mVertices = new aiVector3D[ size.vertices_per_mesh ];
+        for( int vertex = 0; vertex < size.vertices_per_mesh; ++vertex ) {
+            mesh->mVertices[ vertex ] = aiVector3D( uniform( generator ), uniform( generator ), uniform( generator ) );
+        }
+        
+        // Pick each vertex's bones and weights, gathered per bone the way ASSIMP stores them.
+        std::vector< std::vector< aiVertexWeight > > bone_weights( size.bones );
+        std::vector< int > chosen( size.influences_per_vertex );
+        std::vector< float > weights( size.influences_per_vertex );
+        for( int vertex = 0; vertex < size.vertices_per_mesh; ++vertex ) {
+            float sum = 0.f;
+            for( int influence = 0; influence < size.influences_per_vertex; ++influence ) {
+                int bone;
+                do {
+                    bone = generator() % size.bones;
+                } while( std::find( chosen.begin(), chosen.begin() + influence, bone ) != chosen.begin() + influence );
+                chosen[ influence ] = bone;
+                weights[ influence ] = 0.01f + uniform( generator );
+                sum += weights[ influence ];
+            }
+            for( int influence = 0; influence < size.influences_per_vertex; ++influence ) {
+                bone_weights[ chosen[ influence ] ].push_back( aiVertexWeight( vertex, weights[ influence ] / sum ) );
+            }
+        }
+        
+        std::vector< aiBone* > bones;
+        for( int bone = 0; bone < size.bones; ++bone ) {
+            if( bone_weights[ bone ].empty() ) continue;
+            
+            aiBone* mesh_bone = new aiBone();
+            mesh_bone->mName = bone_nodes[ bone ]->mName;
+            mesh_bone->mNumWeights = bone_weights[ bone ].size();
+            mesh_bone->mWeights = new aiVertexWeight[ mesh_bone->mNumWeights ];
+            std::copy( bone_weights[ bone ].begin(), bone_weights[ bone ].end(), mesh_bone->mWeights );
+            bones.push_back( mesh_bone );
+        }
+        mesh->mNumBones = bones.size();
+        mesh->mBones = new aiBone*[ bones.size() ];
+        std::copy( bones.begin(), bones.end(), mesh->mBones );
+        
+        scene->mMeshes[ mesh_index ] = mesh;
+    }
+    
+    return scene;
+}
+
+// Returns the fastest of `repeat` runs of `run`, in seconds.
+template< typename Function >
+double time_best_of( int repeat, const Function& run )
+{
+    double best = 0.;
+    for( int i = 0; i < repeat; ++i ) {
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+        if( 0 == i || seconds < best ) best = seconds;
+    }
+    return best;
+}
+
+void print_stage( const char* stage, double seconds, double items, const char* item_name, size_t bytes = 0 )
+{
+    printf( "    %-34s %10.4f s %12.3g %s/s", stage, seconds, seconds > 0 ? items / seconds : 0., item_name );
+    if( bytes ) printf( " %10.1f MB/s", seconds > 0 ? bytes / seconds / ( 1024*1024 ) : 0. );
+    printf( "\n" );
+}
+
+void bench( const SceneSize& size, int repeat, int threads, const std::string& directory )
+{
+    /*
+    Times each stage of the rig path on a scene of `size`, writing files to `directory`.
+    */
+    
+    aiScene* scene = make_rigged_scene( size );
+    
+    const int vertices = size.meshes * size.vertices_per_mesh;
+    const double nonzeros = double( vertices ) * size.influences_per_vertex;
+    
+    std::vector< aiVector3D > joints;
+    std::vector< std::pair< int, int > > bones;
+    std::vector< float > weights;
+    SparseWeights sparse_weights;
+    Influences influences;
+    
+    const double save_rig_seconds = time_best_of( repeat, [&]() { save_rig( scene, joints, bones, weights, threads ); } );
+    const double save_rig_sparse_seconds = time_best_of( repeat, [&]() { save_rig_sparse( scene, joints, bones, sparse_weights, threads ); } );
+    const double save_rig_influences_seconds = time_best_of( repeat, [&]() { save_rig_influences( scene, joints, bones, influences, 4, threads ); } );
+    
+    RestPose rest_pose;
+    save_rest_pose( scene, rest_pose, threads );
+    Influences sparse_influences;
+    influences_from_weights( sparse_weights, sparse_influences );
+    SkinningError skinning_error;
+    const double verify_seconds = time_best_of( repeat, [&]() { verify_skinning( scene, bones, rest_pose, sparse_influences, std::vector< int >(), skinning_error, 4, threads ); } );
+    
+    const std::string tgf = directory + "/bench.tgf";
+    const std::string dmat = directory + "/bench.dmat";
+    const std::string sparse_dmat = directory + "/bench.sparse.dmat";
+    const std::string skin = directory + "/bench.skin";
+    const std::string rig = directory + "/bench.rig";
+    
+    const double tgf_seconds = time_best_of( repeat, [&]() { save_skeleton_to_TGF( tgf, joints, bones, threads ); } );
+    const size_t tgf_bytes = os_path_getsize( tgf );
+    
+    const double dmat_seconds = time_best_of( repeat, [&]() { save_weights_to_DMAT( dmat, vertices, bones.size(), weights, false, threads ); } );
+    const size_t dmat_bytes = os_path_getsize( dmat );
+    
+    const double binary_dmat_seconds = time_best_of( repeat, [&]() { save_weights_to_DMAT( dmat, vertices, bones.size(), weights, true ); } );
+    const size_t binary_dmat_bytes = os_path_getsize( dmat );
+    
+    const double sparse_dmat_seconds = time_best_of( repeat, [&]() { save_sparse_weights_to_DMAT( sparse_dmat, sparse_weights, false, threads ); } );
+    const size_t sparse_dmat_bytes = os_path_getsize( sparse_dmat );
+    
+    const double skin_seconds = time_best_of( repeat, [&]() { std::ofstream out( skin, std::ios::binary ); save_influences_to_SKIN( out, influences ); } );
+    const size_t skin_bytes = os_path_getsize( skin );
+    
+    const double rig_seconds = time_best_of( repeat, [&]() {
+        RigFileWriter writer;
+        writer.add_skeleton( joints, bones );
+        writer.add_weights( vertices, bones.size(), weights );
+        std::ofstream out( rig, std::ios::binary );
+        writer.write( out );
+    } );
+    const size_t rig_bytes = os_path_getsize( rig );
+    
+    const double streaming_seconds = time_best_of( repeat, [&]() { save_rig_streaming( scene, joints, bones, dmat, false, threads ); } );
+    const size_t streaming_bytes = os_path_getsize( dmat );
+    
+    unlink( tgf.c_str() );
+    unlink( dmat.c_str() );
+    unlink( sparse_dmat.c_str() );
+    unlink( skin.c_str() );
+    unlink( rig.c_str() );
+    delete scene;
+    
+    printf( "## %d meshes x %d vertices, %d bones (depth %d), %d influences per vertex\n",
+        size.meshes, size.vertices_per_mesh, size.bones, size.depth, size.influences_per_vertex );
+    print_stage( "save_rig", save_rig_seconds, nonzeros, "weights" );
+    print_stage( "save_rig_sparse", save_rig_sparse_seconds, nonzeros, "weights" );
+    print_stage( "save_rig_influences (top 4)", save_rig_influences_seconds, nonzeros, "weights" );
+    print_stage( "verify_skinning", verify_seconds, double( vertices ) * skinning_error.poses, "vertices" );
+    print_stage( "save_skeleton_to_TGF", tgf_seconds, joints.size(), "joints", tgf_bytes );
+    print_stage( "save_weights_to_DMAT (text)", dmat_seconds, double( vertices ) * bones.size(), "values", dmat_bytes );
+    print_stage( "save_weights_to_DMAT (binary)", binary_dmat_seconds, double( vertices ) * bones.size(), "values", binary_dmat_bytes );
+    print_stage( "save_sparse_weights_to_DMAT (text)", sparse_dmat_seconds, nonzeros, "weights", sparse_dmat_bytes );
+    print_stage( "save_influences_to_SKIN (8-bit)", skin_seconds, double( vertices ) * 4, "influences", skin_bytes );
+    print_stage( "RigFileWriter (dense)", rig_seconds, double( vertices ) * bones.size(), "values", rig_bytes );
+    print_stage( "save_rig_streaming (text)", streaming_seconds, double( vertices ) * bones.size(), "values", streaming_bytes );
+    fflush( stdout );
+}
+
+void bench_usage( const char* argv0 )
+{
+    std::cerr << "Usage: " << argv0 << " [--meshes M --vertices V --bones B --depth D --influences K] [--repeat R] [--threads N]" << std::endl;
+    std::cerr << "Without any sizes, runs a sweep of scene sizes. With any, runs just that size (the rest default to the sweep's smallest)." << std::endl;
+}
+}
+
+int main( int argc, char* argv[] )
+{
+    SceneSize custom = { 4, 10000, 64, 8, 4 };
+    bool is_custom = false;
+    int repeat = 3;
+    int threads = 1;
+    
+    for( int i = 1; i < argc; ++i ) {
+        const std::string arg( argv[i] );
+        if( i+1 >= argc ) {
+            bench_usage( argv[0] );
+            return -1;
+        }
+        const int value = atoi( argv[++i] );
+        if( value <= 0 ) {
+            bench_usage( argv[0] );
+            return -1;
+        }
+        
+        if( arg == "--meshes" ) { custom.meshes = value; is_custom = true; }
+        else if( arg == "--vertices" ) { custom.vertices_per_mesh = value; is_custom = true; }
+        else if( arg == "--bones" ) { custom.bones = value; is_custom = true; }
+        else if( arg == "--depth" ) { custom.depth = value; is_custom = true; }
+        else if( arg == "--influences" ) { custom.influences_per_vertex = value; is_custom = true; }
+        else if( arg == "--repeat" ) repeat = value;
+        else if( arg == "--threads" ) threads = value;
+        else {
+            bench_usage( argv[0] );
+            return -1;
+        }
+    }
+    
+    if( custom.influences_per_vertex > custom.bones ) {
+        std::cerr << "ERROR: A vertex can't have more influences than there are bones." << std::endl;
+        return -1;
+    }
+    
+    std::vector< SceneSize > sizes;
+    if( is_custom ) sizes.push_back( custom );
+    else {
+        const SceneSize sweep[] = {
+            { 4, 10000, 64, 8, 4 },
+            { 4, 50000, 64, 8, 4 },
+            { 16, 12500, 150, 16, 4 },
+            { 1, 200000, 150, 16, 8 },
+            { 64, 4000, 256, 64, 4 },
+            };
+        sizes.assign( sweep, sweep + sizeof( sweep ) / sizeof( sweep[0] ) );
+    }
+    
+    char directory[] = "/tmp/rig_converter_bench.XXXXXX";
+    if( nullptr == mkdtemp( directory ) ) {
+        std::cerr << "ERROR: Unable to make a temporary directory." << std::endl;
+        return -1;
+    }
+    
+    printf( "# Best of %d runs, %d threads, writing to %s\n", repeat, threads, directory );
+    for( const auto& size : sizes ) bench( size, repeat, threads, directory );
+    
+    rmdir( directory );
+    
+    return 0;
+}
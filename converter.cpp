@@ -1,22 +1,70 @@
-// c++ -std=c++11 converter.cpp -o converter -I/usr/local/include -L/usr/local/lib -lassimp -g -Wall
+// c++ -std=c++17 converter.cpp -o converter -I/usr/local/include -L/usr/local/lib -lassimp -pthread -g -Wall
 /// When debugging, link against my assimp library:
-// c++ -std=c++11 converter.cpp -o converter -I/usr/local/include -L/Users/yotam/Work/ext/assimp/build/code -lassimpd -g -Wall
+// c++ -std=c++17 converter.cpp -o converter -I/usr/local/include -L/Users/yotam/Work/ext/assimp/build/code -lassimpd -pthread -g -Wall
 
 #define SAVE_RIG 1
 
 #include <iostream>
 #include <iomanip> // setw, setprecision
 #include <fstream>
+#include <sstream>
 #include <algorithm> // pair
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
+#include <map>
 #include <cassert>
+#include <cstdio> // snprintf
+#include <cmath> // lrintf
+#include <cstring> // memcpy
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <ctime> // clock
+#include <future> // async
+#include <deque>
+#include <condition_variable>
+#include <csignal> // signal
+#include <cerrno>
+
+#include <dirent.h> // opendir, readdir
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/resource.h> // getrusage
+#include <unistd.h> // unlink, rmdir
+#include <fcntl.h> // open
+#include <signal.h> // kill
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h> // FICLONE
+#endif
+
+// std::to_chars() for floats gives the shortest text that reads back as the same float.
+// It needs C++17 and a recent standard library; otherwise we fall back to (slower) snprintf() and strtof().
+#if __cplusplus >= 201703L && defined( __has_include )
+#if __has_include( <charconv> )
+#include <charconv>
+#endif
+#endif
+#if defined( __cpp_lib_to_chars ) && __cpp_lib_to_chars >= 201611L
+#define HAVE_FLOAT_TO_CHARS 1
+#else
+#define HAVE_FLOAT_TO_CHARS 0
+#endif
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
 
 #include <assimp/Exporter.hpp>
+#include <assimp/Importer.hpp>
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <assimp/config.h>
+
+#include "rig_file.h"
 
 namespace
 {
@@ -63,6 +111,18 @@ bool os_path_exists( const std::string& name ) {
     }   
 }
 
+// Returns the size in bytes of the file named `name`, or 0 if it can't be found.
+size_t os_path_getsize( const std::string& name ) {
+    struct stat info;
+    if( 0 != stat( name.c_str(), &info ) ) return 0;
+    return info.st_size;
+}
+
+bool os_path_isdir( const std::string& name ) {
+    struct stat info;
+    return 0 == stat( name.c_str(), &info ) && S_ISDIR( info.st_mode );
+}
+
 void print_importers( std::ostream& out )
 {
     out << "## Importers:\n";
@@ -91,24 +151,37 @@ void print_exporters( std::ostream& out )
 
 const char* IdFromExtension( const std::string& extension )
 {
-    Assimp::Exporter exporter;
-    const size_t count = exporter.GetExportFormatCount();
+    /*
+    Returns the ASSIMP export format id for `extension` (without the dot), or nullptr if there isn't one.
+    The table of extensions is built from an Exporter the first time and then reused,
+    so repeated lookups (and lookups from several threads) don't each construct an Exporter.
+    */
     
-    for( size_t i = 0; i < count; ++i )
-    {
-        const aiExportFormatDesc* desc = exporter.GetExportFormatDescription( i );
-        assert( desc );
+    static const std::map< std::string, std::pair< std::string, std::string > > extension_to_format = []() {
+        std::map< std::string, std::pair< std::string, std::string > > table;
+        
+        Assimp::Exporter exporter;
+        const size_t count = exporter.GetExportFormatCount();
         
-        if( extension == desc->fileExtension )
+        for( size_t i = 0; i < count; ++i )
         {
-            std::cout << "Found a match for extension: " << extension << std::endl;
-            std::cout << desc->fileExtension << ": " << desc->description << " (id: " << desc->id << ")" << std::endl;
+            const aiExportFormatDesc* desc = exporter.GetExportFormatDescription( i );
+            assert( desc );
             
-            return desc->id;
+            // The first format with an extension wins.
+            table.emplace( desc->fileExtension, std::make_pair( std::string( desc->id ), std::string( desc->description ) ) );
         }
-    }
+        
+        return table;
+    }();
     
-    return nullptr;
+    const auto found = extension_to_format.find( extension );
+    if( found == extension_to_format.end() ) return nullptr;
+    
+    std::cout << "Found a match for extension: " << extension << std::endl;
+    std::cout << extension << ": " << found->second.second << " (id: " << found->second.first << ")" << std::endl;
+    
+    return found->second.first.c_str();
 }
 
 }
@@ -116,30 +189,397 @@ const char* IdFromExtension( const std::string& extension )
 #if SAVE_RIG
 namespace
 {
-typedef std::unordered_map< std::string, std::string > StringToString;
-typedef std::unordered_map< std::string, aiVector3D > StringToVector3D;
+template< typename Body >
+void parallel_for( int count, int num_threads, const Body& body )
+{
+    /*
+    Calls `body( i, thread_index )` for every `i` in [0, count) on `num_threads` threads
+    (the calling thread is one of them), where `thread_index` is in [0, num_threads).
+    Indices are handed out one at a time, so items of uneven cost balance out.
+    Callers must make `num_threads` at least 1 and at most `count`.
+    */
+    
+    assert( num_threads >= 1 );
+    
+    if( 1 == num_threads ) {
+        for( int i = 0; i < count; ++i ) body( i, 0 );
+        return;
+    }
+    
+    std::atomic< int > next( 0 );
+    auto work = [&]( int thread_index ) {
+        for( int i = next++; i < count; i = next++ ) body( i, thread_index );
+    };
+    
+    std::vector< std::thread > threads;
+    for( int thread_index = 1; thread_index < num_threads; ++thread_index ) threads.emplace_back( work, thread_index );
+    work( 0 );
+    for( auto& thread : threads ) thread.join();
+}
+
+// The number of threads to use for `count` items when asked for `num_threads`.
+int clamp_threads( int num_threads, size_t count )
+{
+    return std::max( 1, int( std::min( size_t( std::max( num_threads, 1 ) ), count ) ) );
+}
+
+// The node hierarchy, with each node's name interned once into a dense integer id.
+// Ids are assigned in depth-first order from the root, so a node's parent
+// always has a smaller id than the node itself.
+struct NodeHierarchy
+{
+    // The parent id of each node; -1 for the root.
+    std::vector< int > parents;
+    // The position of each node (the translation of its accumulated transformation).
+    std::vector< aiVector3D > positions;
+    // Each node and its accumulated transformation (from the node's space to the scene's).
+    std::vector< const aiNode* > nodes;
+    std::vector< aiMatrix4x4 > transformations;
+    std::unordered_map< std::string, int > name_to_id;
+    
+    int size() const { return parents.size(); }
+};
+
+void flatten_hierarchy( const aiNode* root, NodeHierarchy& hierarchy ) {
+    /*
+    Fills `hierarchy` with every node below and including `root`.
+    Uses an explicit stack rather than recursion, so very deep hierarchies can't overflow the call stack.
+    */
+    
+    assert( root );
+    
+    struct Visit
+    {
+        const aiNode* node;
+        int parent;
+        aiMatrix4x4 parent_transformation;
+    };
+    std::vector< Visit > stack;
+    stack.push_back( Visit{ root, -1, aiMatrix4x4() } );
+    
+    while( !stack.empty() ) {
+        const Visit visit = stack.back();
+        stack.pop_back();
+        
+        const aiNode* node = visit.node;
+        assert( node );
+        const int id = hierarchy.size();
+        
+        // We shouldn't have yet seen the node.
+        const bool unseen = hierarchy.name_to_id.emplace( node->mName.C_Str(), id ).second;
+        assert( unseen );
+        (void)unseen;
+        
+        const aiMatrix4x4 transformation_so_far = visit.parent_transformation * node->mTransformation;
+        
+        // The root node will not have a parent.
+        hierarchy.parents.push_back( visit.parent );
+        hierarchy.positions.push_back( aiVector3D( transformation_so_far.a4, transformation_so_far.b4, transformation_so_far.c4 ) );
+        hierarchy.nodes.push_back( node );
+        hierarchy.transformations.push_back( transformation_so_far );
+        
+        // Push the children in reverse, so that they are visited in order.
+        for( int child_index = int( node->mNumChildren ) - 1; child_index >= 0; --child_index ) {
+            stack.push_back( Visit{ node->mChildren[ child_index ], id, transformation_so_far } );
+        }
+    }
+}
+}
+
+// The rest pose of save_rig()'s skeleton, for forward kinematics and skinning.
+// Joints are in the order of joints_out, in which parents come before their children,
+// so one pass over the joints computes every global transformation:
+//     global[j] = parents[j] < 0 ? local[j] : global[ parents[j] ] * local[j]
+// and the skinning matrix of bone b is global[ bones_out[b].second ] * inverse_bind_matrices[b].
+struct RestPose
+{
+    // The name of each joint's node.
+    std::vector< std::string > names;
+    // The parent joint of each joint, or -1 for a root (a joint that is no bone's end).
+    std::vector< int > parents;
+    // Each joint's transformation relative to its parent joint's space, or to the scene's for a root.
+    std::vector< aiMatrix4x4 > local_transformations;
+    // Each joint's transformation to the scene's space.
+    std::vector< aiMatrix4x4 > global_transformations;
+    // The inverse bind matrix (aiBone::mOffsetMatrix) of each bone: from mesh space to the space of the bone's end joint.
+    // If meshes disagree, the first mesh's.
+    std::vector< aiMatrix4x4 > inverse_bind_matrices;
+};
+
+namespace
+{
+// What steps 1-4 of save_rig() produce besides joints_out and bones_out:
+// where each mesh's vertices start in the flattened vertex list and
+// which column of the weight matrix each mesh bone is.
+// When welding, the flattened vertex list (the rows of the weight matrix) has each mesh's welded vertices instead.
+struct RigLayout
+{
+    std::vector< int > first_vertex_offsets;
+    int total_vertex_num = 0;
+    // When welding, vertex_rows[ mesh_index ][ vertex ] is the welded vertex (counting from the mesh's first) of each vertex of the mesh,
+    // and row_vertices[ mesh_index ][ row ] is the first vertex of the mesh welded into each.
+    // Both are empty otherwise.
+    std::vector< std::vector< int > > vertex_rows;
+    std::vector< std::vector< int > > row_vertices;
+    // mesh_bone_columns[ mesh_index ][ bone_index ] is the index into bones_out of scene->mMeshes[ mesh_index ]->mBones[ bone_index ].
+    std::vector< std::vector< int > > mesh_bone_columns;
+    // Every (mesh_index, bone_index) pair, in order.
+    // Each writes to its own part of the weight matrix (unless a mesh has two bones with the same name),
+    // so they can be processed in parallel.
+    std::vector< std::pair< int, int > > mesh_bones;
+    
+    // The row of the weight matrix for `vertex` of mesh `mesh_index`,
+    // or -1 if it was welded into an earlier vertex, which has the row (and the same weights).
+    int row( int mesh_index, int vertex ) const {
+        if( vertex_rows.empty() ) return first_vertex_offsets[ mesh_index ] + vertex;
+        const int local_row = vertex_rows[ mesh_index ][ vertex ];
+        return row_vertices[ mesh_index ][ local_row ] == vertex ? first_vertex_offsets[ mesh_index ] + local_row : -1;
+    }
+    
+    // When welding, the row of the weight matrix for each vertex of the unwelded flattened vertex list.
+    std::vector< int > weld_remap() const {
+        std::vector< int > remap;
+        for( size_t mesh_index = 0; mesh_index < vertex_rows.size(); ++mesh_index ) {
+            for( const int local_row : vertex_rows[ mesh_index ] ) remap.push_back( first_vertex_offsets[ mesh_index ] + local_row );
+        }
+        return remap;
+    }
+};
+
+void weld_mesh_vertices( const aiMesh* mesh, std::vector< int >& vertex_rows, std::vector< int >& row_vertices )
+{
+    /*
+    Welds the vertices of `mesh` that have the same position, like aiProcess_JoinIdenticalVertices
+    but comparing only positions (so vertices split for normals or texture coordinates are welded too).
+    Fills `row_vertices` with the first vertex at each distinct position, in vertex order,
+    and `vertex_rows` with the index into `row_vertices` of each vertex's position.
+    */
+    
+    assert( mesh );
+    
+    const int num_vertices = mesh->mNumVertices;
+    vertex_rows.resize( num_vertices );
+    row_vertices.clear();
+    
+    // An open addressing hash table of indices into row_vertices, at most half full.
+    size_t capacity = 1;
+    while( capacity < 2 * size_t( num_vertices ) ) capacity <<= 1;
+    const size_t mask = capacity - 1;
+    std::vector< int > table( capacity, -1 );
+    
+    for( int vertex = 0; vertex < num_vertices; ++vertex ) {
+        const aiVector3D& position = mesh->mVertices[ vertex ];
+        
+        // Adding 0 turns -0 into 0, so the two (which compare equal) hash the same.
+        const float coordinates[3] = { position.x + 0.f, position.y + 0.f, position.z + 0.f };
+        uint32_t bits[3];
+        memcpy( bits, coordinates, sizeof( bits ) );
+        uint64_t hash = bits[0] * 0x9E3779B97F4A7C15ULL ^ bits[1] * 0xC2B2AE3D27D4EB4FULL ^ bits[2] * 0x165667B19E3779F9ULL;
+        hash ^= hash >> 29;
+        
+        size_t slot = hash & mask;
+        while( table[ slot ] != -1 && !( mesh->mVertices[ row_vertices[ table[ slot ] ] ] == position ) ) slot = ( slot + 1 ) & mask;
+        
+        if( table[ slot ] == -1 ) {
+            table[ slot ] = row_vertices.size();
+            row_vertices.push_back( vertex );
+        }
+        vertex_rows[ vertex ] = table[ slot ];
+    }
+}
 
-void recurse( const aiNode* node, const aiMatrix4x4& parent_transformation, StringToVector3D& name2position, StringToString& name2parent ) {
-    assert( node );
-    const std::string name( node->mName.C_Str() );
+bool extract_skeleton( const aiScene* scene, std::vector< aiVector3D >& joints_out, std::vector< std::pair< int, int > >& bones_out, RigLayout& layout, std::string& error, int num_threads = 1, bool weld = false, RestPose* rest_pose_out = nullptr )
+{
+    /*
+    Steps 1-4 of save_rig(). Fills `joints_out` and `bones_out` as described there
+    and `layout` with what step 5 needs to place the weights.
+    Returns false (and sets `error`) if a mesh bone isn't a node of the hierarchy or is its root,
+    which has no parent to be the bone's start joint.
+    If `weld` is true, each mesh's vertices with the same position become one row (see weld_mesh_vertices()).
+    If `rest_pose_out` isn't null, fills it with the skeleton's rest pose.
+    Steps 1 (when welding) and 3 run on up to `num_threads` threads.
+    */
+    
+    assert( scene );
+    assert( scene->mRootNode );
+    
+    /// 1
+    // Flattening is taken care of by ASSIMP saving to OBJ.
+    if( weld ) {
+        layout.vertex_rows.resize( scene->mNumMeshes );
+        layout.row_vertices.resize( scene->mNumMeshes );
+        parallel_for( scene->mNumMeshes, clamp_threads( num_threads, scene->mNumMeshes ), [&]( int mesh_index, int ) {
+            weld_mesh_vertices( scene->mMeshes[ mesh_index ], layout.vertex_rows[ mesh_index ], layout.row_vertices[ mesh_index ] );
+        } );
+    }
+    std::vector< int >& first_vertex_offsets = layout.first_vertex_offsets;
+    int& total_vertex_num = layout.total_vertex_num;
+    first_vertex_offsets.resize( scene->mNumMeshes );
+    // The constructor for ints should set them to zero.
+    assert( 0 == scene->mNumMeshes || 0 == first_vertex_offsets.at(0) );
+    // Each mesh's first vertex comes immediately after the previous mesh's last vertex.
+    // If the mesh's have N, M, and P vertices, then the offsets would be: [ 0, N, N+M ].
+    total_vertex_num = 0;
+    for( int mesh_index = 0; mesh_index < int( scene->mNumMeshes ); ++mesh_index ) {
+        first_vertex_offsets.at( mesh_index ) = total_vertex_num;
+        total_vertex_num += weld ? layout.row_vertices[ mesh_index ].size() : scene->mMeshes[ mesh_index ]->mNumVertices;
+    }
+    
+    layout.mesh_bones.clear();
+    layout.mesh_bone_columns.resize( scene->mNumMeshes );
+    for( int mesh_index = 0; mesh_index < int( scene->mNumMeshes ); ++mesh_index ) {
+        const aiMesh* mesh = scene->mMeshes[ mesh_index ];
+        assert( mesh );
+        
+        layout.mesh_bone_columns.at( mesh_index ).resize( mesh->mNumBones );
+        for( int bone_index = 0; bone_index < int( mesh->mNumBones ); ++bone_index ) {
+            layout.mesh_bones.push_back( std::make_pair( mesh_index, bone_index ) );
+        }
+    }
+    
+    
+    /// 2
+    NodeHierarchy hierarchy;
+    flatten_hierarchy( scene->mRootNode, hierarchy );
     
-    // We shouldn't have yet seen the node in any of our output maps.
-    assert( name2position.find( name ) == name2position.end() );
-    assert( name2parent.find( name ) == name2parent.end() );
     
-    const aiMatrix4x4 transformation_so_far = parent_transformation * node->mTransformation;
+    /// 3
+    // Mark the used bones and joints by node id. This is the only place we look up names.
+    // Each thread marks its own flags, which are merged afterwards.
+    // Until step 4, mesh_bone_columns holds the node id of each mesh bone.
+    num_threads = clamp_threads( num_threads, layout.mesh_bones.size() );
+    std::vector< std::vector< char > > thread_used_bones( num_threads, std::vector< char >( hierarchy.size(), 0 ) );
+    std::vector< std::vector< char > > thread_used_joints( num_threads, std::vector< char >( hierarchy.size(), 0 ) );
+    // Why each mesh bone can't be used, if it can't: 1 if it isn't a node, 2 if it is the root.
+    std::vector< char > bad_bones( layout.mesh_bones.size(), 0 );
+    parallel_for( layout.mesh_bones.size(), num_threads, [&]( int i, int thread_index ) {
+        const int mesh_index = layout.mesh_bones[i].first;
+        const int bone_index = layout.mesh_bones[i].second;
+        const aiBone* bone = scene->mMeshes[ mesh_index ]->mBones[ bone_index ];
+        assert( bone );
+        
+        const auto found = hierarchy.name_to_id.find( bone->mName.C_Str() );
+        if( found == hierarchy.name_to_id.end() ) {
+            bad_bones[i] = 1;
+            return;
+        }
+        const int bone_end_joint = found->second;
+        // Bones store the end joint name.
+        // The bone must have a start joint that is the end joint's parent.
+        if( hierarchy.parents[ bone_end_joint ] < 0 ) {
+            bad_bones[i] = 2;
+            return;
+        }
+        
+        std::vector< char >& is_used_bone = thread_used_bones[ thread_index ];
+        std::vector< char >& is_used_joint = thread_used_joints[ thread_index ];
+        is_used_bone[ bone_end_joint ] = 1;
+        is_used_joint[ bone_end_joint ] = 1;
+        is_used_joint[ hierarchy.parents[ bone_end_joint ] ] = 1;
+        
+        layout.mesh_bone_columns[ mesh_index ][ bone_index ] = bone_end_joint;
+    } );
+    
+    for( size_t i = 0; i < bad_bones.size(); ++i ) {
+        if( !bad_bones[i] ) continue;
+        const int mesh_index = layout.mesh_bones[i].first;
+        error = std::string( "The bone '" ) + scene->mMeshes[ mesh_index ]->mBones[ layout.mesh_bones[i].second ]->mName.C_Str() + "' of mesh " + std::to_string( mesh_index )
+            + ( 1 == bad_bones[i] ? " is not a node of the scene." : " is the scene's root node, so it has no start joint." );
+        joints_out.clear();
+        bones_out.clear();
+        return false;
+    }
+    
+    // Merge the threads' flags into the first thread's.
+    std::vector< char >& is_used_bone = thread_used_bones.front();
+    std::vector< char >& is_used_joint = thread_used_joints.front();
+    for( int thread_index = 1; thread_index < num_threads; ++thread_index ) {
+        for( int node = 0; node < hierarchy.size(); ++node ) {
+            is_used_bone[ node ] |= thread_used_bones[ thread_index ][ node ];
+            is_used_joint[ node ] |= thread_used_joints[ thread_index ][ node ];
+        }
+    }
+    
+    
+    /// 4
+    // Joints and bones are saved in node id order.
+    // Save joints_out.
+    joints_out.clear();
+    // We need a reverse map (node id to joint index) for saving bones_out.
+    std::vector< int > node_to_joint( hierarchy.size(), -1 );
+    for( int node = 0; node < hierarchy.size(); ++node ) {
+        if( !is_used_joint[ node ] ) continue;
+        node_to_joint[ node ] = joints_out.size();
+        joints_out.push_back( hierarchy.positions[ node ] );
+    }
+    
+    // Save bones_out.
+    bones_out.clear();
+    // We need a reverse map (node id to bone index) for saving weights_out.
+    std::vector< int > node_to_bone( hierarchy.size(), -1 );
+    for( int node = 0; node < hierarchy.size(); ++node ) {
+        if( !is_used_bone[ node ] ) continue;
+        node_to_bone[ node ] = bones_out.size();
+        bones_out.push_back( std::make_pair(
+            // start is parent
+            node_to_joint[ hierarchy.parents[ node ] ],
+            // end is child
+            node_to_joint[ node ]
+            ) );
+    }
     
-    name2position[ name ] = aiVector3D( transformation_so_far.a4, transformation_so_far.b4, transformation_so_far.c4 );
-    // The root node will not have a parent.
-    if( nullptr != node->mParent ) name2parent[ name ] = node->mParent->mName.C_Str();
+    // Replace the node ids in mesh_bone_columns with bone indices.
+    for( auto& columns : layout.mesh_bone_columns ) {
+        for( auto& column : columns ) column = node_to_bone[ column ];
+    }
     
-    for( int child_index = 0; child_index < node->mNumChildren; ++child_index ) {
-        recurse( node->mChildren[ child_index ], transformation_so_far, name2position, name2parent );
+    if( rest_pose_out ) {
+        RestPose& pose = *rest_pose_out;
+        pose.parents.assign( joints_out.size(), -1 );
+        pose.names.clear();
+        pose.local_transformations.clear();
+        pose.global_transformations.clear();
+        for( int node = 0; node < hierarchy.size(); ++node ) {
+            if( !is_used_joint[ node ] ) continue;
+            // A bone's start joint is its end joint's parent node,
+            // so a joint's local transformation is its node's own.
+            const int joint = node_to_joint[ node ];
+            if( is_used_bone[ node ] ) pose.parents[ joint ] = node_to_joint[ hierarchy.parents[ node ] ];
+            pose.names.push_back( hierarchy.nodes[ node ]->mName.C_Str() );
+            pose.local_transformations.push_back( pose.parents[ joint ] < 0 ? hierarchy.transformations[ node ] : hierarchy.nodes[ node ]->mTransformation );
+            pose.global_transformations.push_back( hierarchy.transformations[ node ] );
+        }
+        
+        // Take each bone's inverse bind matrix from the first mesh that has the bone.
+        pose.inverse_bind_matrices.assign( bones_out.size(), aiMatrix4x4() );
+        std::vector< char > has_inverse_bind_matrix( bones_out.size(), 0 );
+        for( const auto& mesh_bone : layout.mesh_bones ) {
+            const int bone = layout.mesh_bone_columns[ mesh_bone.first ][ mesh_bone.second ];
+            if( has_inverse_bind_matrix[ bone ] ) continue;
+            has_inverse_bind_matrix[ bone ] = 1;
+            pose.inverse_bind_matrices[ bone ] = scene->mMeshes[ mesh_bone.first ]->mBones[ mesh_bone.second ]->mOffsetMatrix;
+        }
     }
+    
+    return true;
+}
 }
+
+bool check_rig( const aiScene* scene, std::string& error )
+{
+    /*
+    Returns false (and sets `error`) if save_rig() and the others can't extract the rig of `scene`:
+    if a mesh bone isn't a node of the scene or is its root node.
+    They print the error and save no rig then, so a conversion checks first and fails with the error instead.
+    */
+    
+    std::vector< aiVector3D > joints;
+    std::vector< std::pair< int, int > > bones;
+    RigLayout layout;
+    return extract_skeleton( scene, joints, bones, layout, error );
 }
 
-void save_rig( const aiScene* scene, std::vector< aiVector3D >& joints_out, std::vector< std::pair< int, int > >& bones_out, std::vector< float >& weights_out )
+void save_rig( const aiScene* scene, std::vector< aiVector3D >& joints_out, std::vector< std::pair< int, int > >& bones_out, std::vector< float >& weights_out, int num_threads = 1, std::vector< int >* weld_remap_out = nullptr )
 {
     /*
     Given an `aiScene*`, fills the output parameters:
@@ -157,6 +597,10 @@ void save_rig( const aiScene* scene, std::vector< aiVector3D >& joints_out, std:
                 bone[1]-weight-for-vertex[2]
                 ...
                 ]
+    If `weld_remap_out` isn't null, each mesh's vertices with the same position
+    share one row of `weights_out`, and `weld_remap_out` is filled with the row
+    of each vertex in scene.meshes (flattened).
+    Steps 3 and 5 run on up to `num_threads` threads.
     */
     
     printf( "# Extracting the rig.\n" );
@@ -188,290 +632,3496 @@ void save_rig( const aiScene* scene, std::vector< aiVector3D >& joints_out, std:
     ///    (I'll save it as a text file compatible with libigl's DMAT: http://libigl.github.io/libigl/file-formats/ )
     
     
-    /// 1
-    // Flattening is taken care of by ASSIMP saving to OBJ.
-    std::vector< int > first_vertex_offsets;
-    int total_vertex_num = 0;
-    first_vertex_offsets.resize( scene->mNumMeshes );
-    // The constructor for ints should set them to zero.
-    assert( 0 == scene->mNumMeshes || 0 == first_vertex_offsets.at(0) );
-    // Each mesh's first vertex comes immediately after the previous mesh's last vertex.
-    // If the mesh's have N, M, and P vertices, then the offsets would be: [ 0, N, N+M ].
-    total_vertex_num = 0;
-    for( int mesh_index = 0; mesh_index < scene->mNumMeshes; ++mesh_index ) {
-        first_vertex_offsets.at( mesh_index ) = total_vertex_num;
-        total_vertex_num += scene->mMeshes[ mesh_index ]->mNumVertices;
-    }
-    
-    
-    /// 2
-    StringToString name2parent;
-    StringToVector3D name2position;
-    const aiMatrix4x4 I;
-    recurse( scene->mRootNode, I, name2position, name2parent );
-    // std::cout << "## name2transformation\n";
-    // print( name2transformation );
-    
-    
-    /// 3
-    typedef std::unordered_set< std::string > StringSet;
-    typedef std::vector< std::string > StringVector;
-    
-    StringSet used_bones, used_joints;
-    for( int mesh_index = 0; mesh_index < scene->mNumMeshes; ++mesh_index ) {
-        const aiMesh* mesh = scene->mMeshes[ mesh_index ];
-        assert( mesh );
-        
-        // Iterate over the bones of the mesh.
-        for( int bone_index = 0; bone_index < mesh->mNumBones; ++bone_index ) {
-            const aiBone* bone = mesh->mBones[ bone_index ];
-            
-            const std::string bone_end_joint_name = bone->mName.C_Str();
-            used_bones.insert( bone_end_joint_name );
-            used_joints.insert( bone_end_joint_name );
-            // Bones store the end joint name.
-            // The bone must have a start joint that is the end joint's parent.
-            assert( name2parent.find( bone_end_joint_name ) != name2parent.end() );
-            used_joints.insert( name2parent[ bone_end_joint_name ] );
-        }
+    /// 1-4
+    RigLayout layout;
+    std::string error;
+    if( !extract_skeleton( scene, joints_out, bones_out, layout, error, num_threads, nullptr != weld_remap_out ) ) {
+        std::cerr << "save_rig(): " << error << std::endl;
+        return;
     }
-    const StringVector ordered_bones( used_bones.begin(), used_bones.end() );
-    const StringVector ordered_joints( used_joints.begin(), used_joints.end() );
-    
+    const int total_vertex_num = layout.total_vertex_num;
+    if( weld_remap_out ) *weld_remap_out = layout.weld_remap();
     
-    /// 4
-    // Save joints_out.
-    joints_out.resize( ordered_joints.size() );
-    // We need a reverse map (index to joint name) for saving bones_out.
-    std::unordered_map< std::string, int > joint_name_to_ordered_joints_index;
-    {
-        int i = 0;
-        for( const auto& name : ordered_joints ) {
-            joints_out.at(i) = name2position[ name ];
-            joint_name_to_ordered_joints_index[ name ] = i;
-            ++i;
-        }
-    }
     
-    // Save bones_out.
-    bones_out.resize( ordered_bones.size() );
-    // We need a reverse map (index to bone name) for saving weights_out.
-    std::unordered_map< std::string, int > bone_name_to_ordered_bones_index;
+    /// 5
+    // Each (mesh, bone) pair writes to its own slice of its bone's column, so they run in parallel without locking.
+    // A mesh may have two bones with the same name, and so the same column and slice;
+    // those run as one task, in order, so that the later one's weights win as they would one after another.
+    std::vector< std::vector< int > > tasks;
     {
-        int i = 0;
-        for( const auto& name : ordered_bones ) {
-            bones_out.at(i) = std::make_pair(
-                // start is parent
-                joint_name_to_ordered_joints_index[ name2parent[ name ] ],
-                // end is child
-                joint_name_to_ordered_joints_index[ name ]
-                );
-            bone_name_to_ordered_bones_index[ name ] = i;
-            ++i;
+        // The task of each (mesh, column) seen so far.
+        std::map< std::pair< int, int >, int > mesh_column_tasks;
+        for( int i = 0; i < int( layout.mesh_bones.size() ); ++i ) {
+            const auto& mesh_bone = layout.mesh_bones[i];
+            const auto mesh_column = std::make_pair( mesh_bone.first, layout.mesh_bone_columns[ mesh_bone.first ][ mesh_bone.second ] );
+            const auto found = mesh_column_tasks.insert( std::make_pair( mesh_column, int( tasks.size() ) ) );
+            if( found.second ) tasks.emplace_back();
+            tasks[ found.first->second ].push_back( i );
         }
     }
     
-    
-    /// 5
     weights_out.assign( total_vertex_num * bones_out.size(), 0.f );
-    for( int mesh_index = 0; mesh_index < scene->mNumMeshes; ++mesh_index ) {
-        const aiMesh* mesh = scene->mMeshes[ mesh_index ];
-        assert( mesh );
-        
-        const int first_vertex_offset = first_vertex_offsets.at( mesh_index );
-        
-        // Iterate over the bones of the mesh.
-        for( int bone_index = 0; bone_index < mesh->mNumBones; ++bone_index ) {
+    parallel_for( tasks.size(), clamp_threads( num_threads, tasks.size() ), [&]( int task, int ) {
+        for( const int i : tasks[ task ] ) {
+            const int mesh_index = layout.mesh_bones[i].first;
+            const int bone_index = layout.mesh_bones[i].second;
+            const aiMesh* mesh = scene->mMeshes[ mesh_index ];
+            assert( mesh );
+            
             const aiBone* bone = mesh->mBones[ bone_index ];
             assert( bone );
-            const std::string bone_name( bone->mName.C_Str() );
+            
+            // The bone's index into bones_out is its column in weights_out.
+            const int bones_out_index = layout.mesh_bone_columns[ mesh_index ][ bone_index ];
+            assert( bones_out_index >= 0 );
+            assert( bones_out_index < int( bones_out.size() ) );
+            float* const column = &weights_out[ size_t( bones_out_index )*total_vertex_num ];
             
             // Iterate over the corresponding vertex weights of the bone.
-            for( int weight_index = 0; weight_index < bone->mNumWeights; ++weight_index ) {
+            for( int weight_index = 0; weight_index < int( bone->mNumWeights ); ++weight_index ) {
                 const aiVertexWeight& weight = bone->mWeights[ weight_index ];
                 
                 const int local_vertex_index = weight.mVertexId;
                 assert( local_vertex_index >= 0 );
-                assert( local_vertex_index < mesh->mNumVertices );
-                assert( local_vertex_index + first_vertex_offset < total_vertex_num );
+                assert( local_vertex_index < int( mesh->mNumVertices ) );
                 
-                // We need to find the global bone index for this bone, using the reverse map.
-                assert( bone_name_to_ordered_bones_index.find( bone_name ) != bone_name_to_ordered_bones_index.end() );
-                const int bones_out_index = bone_name_to_ordered_bones_index[ bone_name ];
-                assert( bones_out_index >= 0 );
-                assert( bones_out_index < bones_out.size() );
+                const int row = layout.row( mesh_index, local_vertex_index );
+                if( row < 0 ) continue;
+                assert( row < total_vertex_num );
                 
-                weights_out.at( bones_out_index*total_vertex_num + first_vertex_offset+local_vertex_index ) = weight.mWeight;
+                column[ row ] = weight.mWeight;
             }
         }
-    }
+    } );
 }
 
-void save_skeleton_to_TGF( const std::string& filename, const std::vector< aiVector3D >& joints, const std::vector< std::pair< int, int > >& bones ) {
+void save_rest_pose( const aiScene* scene, RestPose& pose_out, int num_threads = 1 )
+{
     /*
-    Saves the given `joints` (positions) and `bones` (pairs of (start,end) indices into joints)
-    to the file named `filename` in TGF format.
-    
-    TGF format: http://libigl.github.io/libigl/file-formats/tgf.html
+    Fills `pose_out` with the rest pose of the skeleton that save_rig() and the others extract
+    (the same joints and bones, in the same order).
+    It is cheap next to extracting the weights.
     */
     
-    std::ofstream out( filename );
-    if( !out ) {
-        std::cerr << "save_skeleton_to_TGF(): Unable to open file for writing: " << filename << std::endl;
-        return;
-    }
-    
-    {
-        // TGF is 1-indexed.
-        int i = 1;
-        for( const auto& position : joints ) {
-            // Each line: index x y z
-            out
-                << std::setw( 4 ) << i << ' '
-                // Q: What should setprecision be to not lose any accuracy when printing a double?
-                // A: 17. See: http://stackoverflow.com/questions/554063/how-do-i-print-a-double-value-with-full-precision-using-cout
-                // Q: Should I use '\n' or endl?
-                // A: '\n'. endl is defined as '\n' plus a flush. The flush slows things
-                //    down and is not needed when outputting to a file.
-                //    Source: http://stackoverflow.com/questions/8689344/portable-end-of-line-newline/8689547#8689547
-                << std::setw( 27 ) << std::setprecision( 17 ) << position.x << ' '
-                << std::setw( 27 ) << std::setprecision( 17 ) << position.y << ' '
-                << std::setw( 27 ) << std::setprecision( 17 ) << position.z << '\n';
-            ++i;
-        }
-    }
-    
-    out << "#" << std::endl;
+    assert( scene );
+    assert( scene->mRootNode );
     
-    for( const auto& bone : bones ) {
-        // Each line: start_index end_index is_bone is_pseudo_edge is_cage
-        // TGF is 1-indexed.
-        // The "1 0 0" means that this is a bone edge, and not another kind of edge.
-        out << std::setw( 4 ) << (bone.first + 1) << ' ' << std::setw( 4 ) << (bone.second + 1) << " 1 0 0" << '\n';
+    std::vector< aiVector3D > joints;
+    std::vector< std::pair< int, int > > bones;
+    RigLayout layout;
+    std::string error;
+    if( !extract_skeleton( scene, joints, bones, layout, error, num_threads, false, &pose_out ) ) {
+        std::cerr << "save_rest_pose(): " << error << std::endl;
+        return;
     }
 }
 
-void save_weights_to_DMAT( const std::string& filename, int rows, int cols, const std::vector< float >& weights ) {
-    /*
-    Saves the given `weights` (column-major matrix) with `rows` and `cols` dimensions
-    to the file named `filename` in DMAT format.
+struct SparseWeights
+{
+    // The weight matrix of save_rig() in compressed sparse column form:
+    // the nonzeros of column (bone) `c` are at positions
+    // [ column_starts[c], column_starts[c+1] ) of `row_indices` and `values`.
+    int rows = 0;
+    int cols = 0;
+    std::vector< int > column_starts;
+    std::vector< int > row_indices;
+    std::vector< float > values;
     
-    DMAT format: http://libigl.github.io/libigl/file-formats/dmat.html
+    size_t nonzeros() const { return values.size(); }
+};
+
+void save_rig_sparse( const aiScene* scene, std::vector< aiVector3D >& joints_out, std::vector< std::pair< int, int > >& bones_out, SparseWeights& weights_out, int num_threads = 1, std::vector< int >* weld_remap_out = nullptr )
+{
+    /*
+    Like save_rig(), but fills `weights_out` with only the nonzero weights,
+    so memory grows with the number of influences rather than #vertices * #bones.
+    The rows and columns (and welding) are the same as save_rig()'s dense matrix.
+    Steps 3 and 5 run on up to `num_threads` threads.
     */
     
-    assert( rows > 0 );
-    assert( cols > 0 );
-    assert( rows * cols == weights.size() );
+    printf( "# Extracting the rig (sparse weights).\n" );
     
-    std::ofstream out( filename );
-    if( !out ) {
-        std::cerr << "save_weights_to_DMAT(): Unable to open file for writing: " << filename << std::endl;
+    assert( scene );
+    assert( scene->mRootNode );
+    // This function doesn't make sense if there aren't any meshes.
+    if( 0 == scene->mNumMeshes ) {
+        std::cerr << "save_rig_sparse(): No meshes means no rig to save." << std::endl;
         return;
     }
     
-    // Save the cols and rows.
-    // Q: Should I use '\n' or endl?
-    // A: '\n'. endl is defined as '\n' plus a flush. The flush slows things
-    //    down and is not needed when outputting to a file.
-    //    Source: http://stackoverflow.com/questions/8689344/portable-end-of-line-newline/8689547#8689547
-    out << cols << ' ' << rows << '\n';
-    
-    for( const auto& val : weights ) {
-        // Q: What should setprecision be to not lose any accuracy when printing a double?
-        // A: 17. See: http://stackoverflow.com/questions/554063/how-do-i-print-a-double-value-with-full-precision-using-cout
-        out << std::setprecision( 17 ) << val << '\n';
+    /// 1-4
+    RigLayout layout;
+    std::string error;
+    if( !extract_skeleton( scene, joints_out, bones_out, layout, error, num_threads, nullptr != weld_remap_out ) ) {
+        std::cerr << "save_rig_sparse(): " << error << std::endl;
+        return;
     }
-}
-#endif
-
-void usage( const char* argv0, std::ostream& out )
-{
-    out << "Usage: " << argv0 << " path/to/input path/to/output" << std::endl;
+    if( weld_remap_out ) *weld_remap_out = layout.weld_remap();
     
-    out << std::endl;
-    print_importers( out );
+    /// 5
+    // Build the columns straight from each mesh bone's weight list in two passes:
+    // count the nonzeros of each (mesh, bone) pair, then place them.
+    // Each pair gets its own range of its column, so both passes run in parallel.
+    // Pairs are placed in order within a column, so the result doesn't depend on `num_threads`.
+    const std::vector< std::pair< int, int > >& mesh_bones = layout.mesh_bones;
+    num_threads = clamp_threads( num_threads, mesh_bones.size() );
     
-    out << std::endl;
-    print_exporters( out );
-}
-
-int main( int argc, char* argv[] )
-{
-    /// We need three arguments: the program, the input path, and the output path.
-    if( 3 != argc ) {
-        usage( argv[0], std::cerr );
-        return -1;
-    }
+    weights_out.rows = layout.total_vertex_num;
+    weights_out.cols = bones_out.size();
     
-    /// Store the input and output paths.
-    const char* inpath = argv[1];
-    const char* outpath = argv[2];
+    std::vector< int > mesh_bone_nonzeros( mesh_bones.size(), 0 );
+    parallel_for( mesh_bones.size(), num_threads, [&]( int i, int ) {
+        const aiBone* bone = scene->mMeshes[ mesh_bones[i].first ]->mBones[ mesh_bones[i].second ];
+        assert( bone );
+        
+        for( int weight_index = 0; weight_index < int( bone->mNumWeights ); ++weight_index ) {
+            const aiVertexWeight& weight = bone->mWeights[ weight_index ];
+            if( 0.f != weight.mWeight && layout.row( mesh_bones[i].first, weight.mVertexId ) >= 0 ) mesh_bone_nonzeros[i] += 1;
+        }
+    } );
     
-    // Exit if the output path already exists.
-    if( os_path_exists( outpath ) ) {
-        std::cerr << "ERROR: Output path exists. Not clobbering: " << outpath << std::endl;
-        usage( argv[0], std::cerr );
-        return -1;
+    // Turn the counts into column starts.
+    weights_out.column_starts.assign( bones_out.size() + 1, 0 );
+    for( size_t i = 0; i < mesh_bones.size(); ++i ) {
+        weights_out.column_starts[ layout.mesh_bone_columns[ mesh_bones[i].first ][ mesh_bones[i].second ] + 1 ] += mesh_bone_nonzeros[i];
+    }
+    for( int column = 0; column < weights_out.cols; ++column ) {
+        weights_out.column_starts[ column+1 ] += weights_out.column_starts[ column ];
     }
     
-    /// Get the extension of the output path and its corresponding ASSIMP id.
-    std::string extension = os_path_splitext( outpath ).second;
-    // os_path_splitext.second returns an extension of the form ".obj".
+    // Turn the counts into the start of each pair's range.
+    std::vector< int > mesh_bone_starts( mesh_bones.size() );
+    {
+        // The next free slot in each column.
+        std::vector< int > column_ends( weights_out.column_starts.begin(), weights_out.column_starts.end() - 1 );
+        for( size_t i = 0; i < mesh_bones.size(); ++i ) {
+            int& end = column_ends[ layout.mesh_bone_columns[ mesh_bones[i].first ][ mesh_bones[i].second ] ];
+            mesh_bone_starts[i] = end;
+            end += mesh_bone_nonzeros[i];
+        }
+    }
+    
+    const int nonzeros = weights_out.column_starts.back();
+    weights_out.row_indices.resize( nonzeros );
+    weights_out.values.resize( nonzeros );
+    parallel_for( mesh_bones.size(), num_threads, [&]( int i, int ) {
+        const aiMesh* mesh = scene->mMeshes[ mesh_bones[i].first ];
+        const aiBone* bone = mesh->mBones[ mesh_bones[i].second ];
+        
+        int end = mesh_bone_starts[i];
+        for( int weight_index = 0; weight_index < int( bone->mNumWeights ); ++weight_index ) {
+            const aiVertexWeight& weight = bone->mWeights[ weight_index ];
+            if( 0.f == weight.mWeight ) continue;
+            
+            assert( weight.mVertexId < mesh->mNumVertices );
+            const int row = layout.row( mesh_bones[i].first, weight.mVertexId );
+            if( row < 0 ) continue;
+            weights_out.row_indices[ end ] = row;
+            weights_out.values[ end ] = weight.mWeight;
+            ++end;
+        }
+    } );
+}
+
+struct Influences
+{
+    // The `count` largest weights of each row (vertex) of save_rig()'s weight matrix and their columns (bones),
+    // stored slot by slot: the weight in slot `s` of row `r` is weights[ s*rows + r ].
+    // Slot 0 holds the largest weight, and unused slots have weight 0 and bone 0.
+    int rows = 0;
+    int cols = 0;
+    int count = 0;
+    std::vector< float > weights;
+    std::vector< int > bones;
+};
+
+// The most influences per vertex that --influences accepts. GPU skinning rarely uses more than 8.
+const int kMaxInfluences = 16;
+
+void save_rig_influences( const aiScene* scene, std::vector< aiVector3D >& joints_out, std::vector< std::pair< int, int > >& bones_out, Influences& influences_out, int count, int num_threads = 1, std::vector< int >* weld_remap_out = nullptr )
+{
+    /*
+    Like save_rig(), but fills `influences_out` with only the `count` largest weights of each vertex,
+    taken straight from each mesh bone's weight list. The weights are not normalized.
+    The rows and columns (and welding) are the same as save_rig()'s dense matrix.
+    Steps 3 and 5 run on up to `num_threads` threads.
+    */
+    
+    printf( "# Extracting the rig (top %d influences).\n", count );
+    
+    assert( count > 0 );
+    assert( scene );
+    assert( scene->mRootNode );
+    // This function doesn't make sense if there aren't any meshes.
+    if( 0 == scene->mNumMeshes ) {
+        std::cerr << "save_rig_influences(): No meshes means no rig to save." << std::endl;
+        return;
+    }
+    
+    /// 1-4
+    RigLayout layout;
+    std::string error;
+    if( !extract_skeleton( scene, joints_out, bones_out, layout, error, num_threads, nullptr != weld_remap_out ) ) {
+        std::cerr << "save_rig_influences(): " << error << std::endl;
+        return;
+    }
+    if( weld_remap_out ) *weld_remap_out = layout.weld_remap();
+    
+    /// 5
+    // Each mesh has its own rows, so meshes run in parallel.
+    // Within a row, a weight only replaces a strictly smaller one, so ties keep the earlier mesh bone.
+    // The weight lists visit rows in any order, so collect each row's slots together (row by row),
+    // and only then store them slot by slot.
+    const int rows = layout.total_vertex_num;
+    std::vector< float > row_weights( size_t( count ) * rows, 0.f );
+    std::vector< int > row_bones( size_t( count ) * rows, 0 );
+    
+    parallel_for( scene->mNumMeshes, clamp_threads( num_threads, scene->mNumMeshes ), [&]( int mesh_index, int ) {
+        const aiMesh* mesh = scene->mMeshes[ mesh_index ];
+        assert( mesh );
+        
+        for( int bone_index = 0; bone_index < int( mesh->mNumBones ); ++bone_index ) {
+            const aiBone* bone = mesh->mBones[ bone_index ];
+            const int column = layout.mesh_bone_columns[ mesh_index ][ bone_index ];
+            
+            for( int weight_index = 0; weight_index < int( bone->mNumWeights ); ++weight_index ) {
+                const aiVertexWeight& weight = bone->mWeights[ weight_index ];
+                const int row = layout.row( mesh_index, weight.mVertexId );
+                if( row < 0 ) continue;
+                
+                float* const weights = &row_weights[ size_t( row )*count ];
+                int* const bones = &row_bones[ size_t( row )*count ];
+                // The last slot is the smallest kept so far (or 0).
+                if( !( weight.mWeight > weights[ count-1 ] ) ) continue;
+                
+                // Insertion sort into the row's slots.
+                int slot = count - 1;
+                for( ; slot > 0 && weights[ slot-1 ] < weight.mWeight; --slot ) {
+                    weights[ slot ] = weights[ slot-1 ];
+                    bones[ slot ] = bones[ slot-1 ];
+                }
+                weights[ slot ] = weight.mWeight;
+                bones[ slot ] = column;
+            }
+        }
+    } );
+    
+    influences_out.rows = rows;
+    influences_out.cols = bones_out.size();
+    influences_out.count = count;
+    influences_out.weights.resize( row_weights.size() );
+    influences_out.bones.resize( row_bones.size() );
+    for( int row = 0; row < rows; ++row ) {
+        for( int slot = 0; slot < count; ++slot ) {
+            influences_out.weights[ size_t( slot )*rows + row ] = row_weights[ size_t( row )*count + slot ];
+            influences_out.bones[ size_t( slot )*rows + row ] = row_bones[ size_t( row )*count + slot ];
+        }
+    }
+}
+
+namespace
+{
+// Formats numbers as text into a large buffer and writes the buffer out in big blocks.
+// This is much faster than `operator<<` with iostream manipulators for each value.
+// Without a stream, it keeps all the text in its buffer instead (see data() and size()).
+class TextWriter
+{
+public:
+    explicit TextWriter( std::ostream& out ) : m_out( &out ) { m_buffer.reserve( kBufferSize ); }
+    TextWriter() {}
+    ~TextWriter() { flush(); }
+    
+    // Writes the shortest text that reads back as exactly `val`.
+    void write( float val ) {
+        reserve( kMaxNumberLength );
+        char* const begin = &m_buffer[0] + m_size;
+#if HAVE_FLOAT_TO_CHARS
+        m_size += std::to_chars( begin, begin + kMaxNumberLength, val ).ptr - begin;
+#else
+        // The fewest significant digits that read back as exactly `val`, like std::to_chars().
+        // 9 are enough for any float.
+        char scientific[ kMaxNumberLength ];
+        int length = 0;
+        for( int digits = 1; ; ++digits ) {
+            length = snprintf( scientific, kMaxNumberLength, "%.*e", digits - 1, val );
+            if( 9 == digits || strtof( scientific, nullptr ) == val ) break;
+        }
+        // Like std::to_chars(), write those digits in fixed notation unless that's longer.
+        const int fixed_length = write_fixed( val, scientific, begin );
+        if( fixed_length > 0 && fixed_length <= length ) {
+            m_size += fixed_length;
+        } else {
+            memcpy( begin, scientific, length );
+            m_size += length;
+        }
+#endif
+    }
+    void write( long long val ) {
+        reserve( kMaxNumberLength );
+        m_size += snprintf( &m_buffer[0] + m_size, kMaxNumberLength, "%lld", val );
+    }
+    void write( char c ) {
+        reserve( 1 );
+        m_buffer[ m_size++ ] = c;
+    }
+    void write( const char* text ) {
+        while( *text ) write( *text++ );
+    }
+    // Writes `val` like printf( format, val ) does. The text must be shorter than kMaxNumberLength.
+    template< typename T >
+    void write_formatted( const char* format, T val ) {
+        reserve( kMaxNumberLength );
+        m_size += snprintf( &m_buffer[0] + m_size, kMaxNumberLength, format, val );
+    }
+    
+    void flush() {
+        if( nullptr == m_out ) return;
+        m_out->write( m_buffer.data(), m_size );
+        m_size = 0;
+    }
+    
+    // The text kept so far without a stream.
+    const char* data() const { return m_buffer.data(); }
+    size_t size() const { return m_size; }
+    void clear() { m_size = 0; }
+    
+private:
+    static const size_t kBufferSize = 1 << 20;
+    // Enough for any float or long long plus the terminating '\0' snprintf() writes.
+    static const size_t kMaxNumberLength = 32;
+    
+#if !HAVE_FLOAT_TO_CHARS
+    // Writes `val`, whose shortest text is `scientific` (like "-1.25e-04" from printf's "%e"),
+    // to `out` in fixed notation with the same digits ("-0.000125"), and returns its length.
+    // Like std::to_chars(), a whole number is written exactly rather than padded with zeros.
+    // Returns 0 instead if it isn't a finite number or wouldn't fit in kMaxNumberLength.
+    static int write_fixed( float val, const char* scientific, char* out ) {
+        const char* text = scientific;
+        const bool negative = ( '-' == *text );
+        if( negative ) ++text;
+        char digits[ kMaxNumberLength ];
+        int count = 0;
+        for( ; *text && 'e' != *text; ++text ) {
+            if( '.' == *text ) continue;
+            if( *text < '0' || *text > '9' ) return 0;
+            digits[ count++ ] = *text;
+        }
+        if( 'e' != *text || 0 == count ) return 0;
+        const int exponent = atoi( text + 1 );
+        
+        // The digits before the point are digits[0..exponent]; none if the exponent is negative.
+        // After it, zeros for a negative exponent and then the rest of the digits.
+        const int integer_digits = exponent + 1;
+        const int fraction_digits = std::max( count - integer_digits, 0 );
+        const int length = int( negative ) + std::max( integer_digits, 1 ) + ( fraction_digits > 0 ? 1 + fraction_digits : 0 );
+        if( length >= int( kMaxNumberLength ) ) return 0;
+        if( 0 == fraction_digits ) return snprintf( out, kMaxNumberLength, "%.0f", val );
+        
+        char* o = out;
+        if( negative ) *o++ = '-';
+        if( integer_digits <= 0 ) *o++ = '0';
+        for( int i = 0; i < integer_digits; ++i ) *o++ = digits[i];
+        *o++ = '.';
+        for( int i = integer_digits; i < count; ++i ) *o++ = ( i < 0 ? '0' : digits[i] );
+        return int( o - out );
+    }
+#endif
+    
+    void reserve( size_t length ) {
+        if( m_size + length > m_buffer.size() ) {
+            flush();
+            // Without a stream, the buffer grows to hold everything.
+            const size_t size = std::max( m_size + length, m_out ? size_t( 0 ) : 2 * m_buffer.size() );
+            m_buffer.resize( kBufferSize > size ? kBufferSize : size );
+        }
+    }
+    
+    std::ostream* m_out = nullptr;
+    std::vector< char > m_buffer;
+    size_t m_size = 0;
+};
+
+template< typename Format >
+void write_text_in_chunks( std::ostream& out, size_t count, size_t chunk_size, int num_threads, const Format& format ) {
+    /*
+    Writes to `out` the text `format( begin, end, writer )` writes to the TextWriter `writer` for the items [begin, end),
+    for all `count` items, exactly as `format( 0, count, writer )` would.
+    With more than one thread, runs of `chunk_size` items are formatted into their own buffers
+    on `num_threads` threads, a few runs per thread at a time, and the buffers are written in order.
+    */
+    
+    const size_t num_chunks = ( count + chunk_size - 1 ) / chunk_size;
+    num_threads = clamp_threads( num_threads, num_chunks );
+    
+    if( 1 == num_threads ) {
+        TextWriter writer( out );
+        format( size_t( 0 ), count, writer );
+        return;
+    }
+    
+    // A few chunks per thread balances uneven chunks while bounding the text held in memory.
+    std::vector< TextWriter > chunks( std::min( num_chunks, size_t( 4 ) * num_threads ) );
+    for( size_t first_chunk = 0; first_chunk < num_chunks; first_chunk += chunks.size() ) {
+        const size_t round_chunks = std::min( chunks.size(), num_chunks - first_chunk );
+        parallel_for( round_chunks, clamp_threads( num_threads, round_chunks ), [&]( int i, int ) {
+            const size_t begin = ( first_chunk + i ) * chunk_size;
+            chunks[i].clear();
+            format( begin, std::min( begin + chunk_size, count ), chunks[i] );
+        } );
+        for( size_t i = 0; i < round_chunks; ++i ) out.write( chunks[i].data(), chunks[i].size() );
+    }
+}
+
+// The items formatted together by each thread of write_text_in_chunks() for the DMAT and TGF writers.
+const size_t kTextChunkSize = 1 << 16;
+
+void write_DMAT_header( std::ostream& out, long long rows, long long cols, bool binary ) {
+    // Q: Should I use '\n' or endl?
+    // A: '\n'. endl is defined as '\n' plus a flush. The flush slows things
+    //    down and is not needed when outputting to a file.
+    //    Source: http://stackoverflow.com/questions/8689344/portable-end-of-line-newline/8689547#8689547
+    
+    // Binary DMAT starts with a "0 0" line. libigl's readDMAT() uses it to tell the two apart.
+    if( binary ) out << "0 0\n";
+    // Save the cols and rows.
+    out << cols << ' ' << rows << '\n';
+}
+
+// Writes `count` values as binary DMAT data (doubles), converting a large block at a time.
+template< typename T >
+void write_DMAT_binary_values( std::ostream& out, const T* values, size_t count ) {
+    const size_t kBlockSize = 1 << 20;
+    std::vector< double > block( std::min( count, kBlockSize ) );
+    for( size_t start = 0; start < count; start += kBlockSize ) {
+        const size_t size = std::min( count - start, kBlockSize );
+        std::copy( values + start, values + start + size, block.begin() );
+        out.write( reinterpret_cast< const char* >( block.data() ), size * sizeof( double ) );
+    }
+}
+}
+
+void save_skeleton_to_TGF( std::ostream& out, const std::vector< aiVector3D >& joints, const std::vector< std::pair< int, int > >& bones, int num_threads = 1 ) {
+    /*
+    Writes the given `joints` (positions) and `bones` (pairs of (start,end) indices into joints)
+    to `out` in TGF format.
+    With `num_threads` threads, formats the lines of runs of joints and bones in parallel;
+    the text is the same for any number of threads.
+    
+    TGF format: http://libigl.github.io/libigl/file-formats/tgf.html
+    */
+    
+    write_text_in_chunks( out, joints.size(), kTextChunkSize, num_threads, [&]( size_t begin, size_t end, TextWriter& writer ) {
+        for( size_t i = begin; i < end; ++i ) {
+            // Each line: index x y z
+            // TGF is 1-indexed.
+            // Q: What should the precision be to not lose any accuracy when printing a double?
+            // A: 17. See: http://stackoverflow.com/questions/554063/how-do-i-print-a-double-value-with-full-precision-using-cout
+            // The widths are those of the std::setw( 4 ) and std::setw( 27 ) this was written with,
+            // so the files are unchanged.
+            writer.write_formatted( "%4d", int( i + 1 ) );
+            writer.write( ' ' );
+            writer.write_formatted( "%27.17g", double( joints[i].x ) );
+            writer.write( ' ' );
+            writer.write_formatted( "%27.17g", double( joints[i].y ) );
+            writer.write( ' ' );
+            writer.write_formatted( "%27.17g", double( joints[i].z ) );
+            writer.write( '\n' );
+        }
+    } );
+    
+    out << "#" << std::endl;
+    
+    write_text_in_chunks( out, bones.size(), kTextChunkSize, num_threads, [&]( size_t begin, size_t end, TextWriter& writer ) {
+        for( size_t i = begin; i < end; ++i ) {
+            // Each line: start_index end_index is_bone is_pseudo_edge is_cage
+            // TGF is 1-indexed.
+            // The "1 0 0" means that this is a bone edge, and not another kind of edge.
+            writer.write_formatted( "%4d", bones[i].first + 1 );
+            writer.write( ' ' );
+            writer.write_formatted( "%4d", bones[i].second + 1 );
+            writer.write( " 1 0 0\n" );
+        }
+    } );
+}
+
+void save_skeleton_to_TGF( const std::string& filename, const std::vector< aiVector3D >& joints, const std::vector< std::pair< int, int > >& bones, int num_threads = 1 ) {
+    /*
+    Saves the given `joints` and `bones` to the file named `filename` in TGF format.
+    */
+    
+    std::ofstream out( filename );
+    if( !out ) {
+        std::cerr << "save_skeleton_to_TGF(): Unable to open file for writing: " << filename << std::endl;
+        return;
+    }
+    
+    save_skeleton_to_TGF( out, joints, bones, num_threads );
+}
+
+void save_weights_to_DMAT( std::ostream& out, int rows, int cols, const std::vector< float >& weights, bool binary = false, int num_threads = 1 ) {
+    /*
+    Writes the given `weights` (column-major matrix) with `rows` and `cols` dimensions
+    to `out` in DMAT format.
+    If `binary` is true, uses DMAT's binary variant, whose data is the
+    column-major matrix as raw doubles. Otherwise, writes each weight as
+    the shortest text that reads back as the same float, formatting
+    runs of weights on `num_threads` threads (the text is the same for any number).
+    
+    DMAT format: http://libigl.github.io/libigl/file-formats/dmat.html
+    */
+    
+    assert( rows > 0 );
+    assert( cols > 0 );
+    assert( size_t( rows ) * cols == weights.size() );
+    
+    write_DMAT_header( out, rows, cols, binary );
+    
+    if( binary ) {
+        write_DMAT_binary_values( out, weights.data(), weights.size() );
+    } else {
+        write_text_in_chunks( out, weights.size(), kTextChunkSize, num_threads, [&]( size_t begin, size_t end, TextWriter& writer ) {
+            for( size_t i = begin; i < end; ++i ) {
+                writer.write( weights[i] );
+                writer.write( '\n' );
+            }
+        } );
+    }
+}
+
+void save_weights_to_DMAT( const std::string& filename, int rows, int cols, const std::vector< float >& weights, bool binary = false, int num_threads = 1 ) {
+    /*
+    Saves the given `weights` to the file named `filename` in DMAT format.
+    */
+    
+    std::ofstream out( filename, binary ? std::ios::binary : std::ios::out );
+    if( !out ) {
+        std::cerr << "save_weights_to_DMAT(): Unable to open file for writing: " << filename << std::endl;
+        return;
+    }
+    
+    save_weights_to_DMAT( out, rows, cols, weights, binary, num_threads );
+}
+
+void save_sparse_weights_to_DMAT( std::ostream& out, const SparseWeights& weights, bool binary = false, int num_threads = 1 ) {
+    /*
+    Writes the nonzeros of the given sparse `weights` as (row, column, weight) triplets
+    to `out` in DMAT format: a #nonzeros by 3 matrix whose first
+    column holds the (0-indexed) vertex rows, the second the (0-indexed) bone columns,
+    and the third the weights.
+    This is the form libigl and Eigen build sparse matrices from (`setFromTriplets()`).
+    The full matrix is #vertices by #bones (the bones in the TGF file).
+    If `binary` is true, uses DMAT's binary variant (see save_weights_to_DMAT()).
+    Text is formatted on `num_threads` threads, like save_weights_to_DMAT().
+    
+    DMAT format: http://libigl.github.io/libigl/file-formats/dmat.html
+    */
+    
+    write_DMAT_header( out, weights.nonzeros(), 3, binary );
+    
+    // The column of each nonzero.
+    std::vector< int > columns( weights.nonzeros() );
+    for( int column = 0; column < weights.cols; ++column ) {
+        std::fill( columns.begin() + weights.column_starts[ column ], columns.begin() + weights.column_starts[ column+1 ], column );
+    }
+    
+    // DMAT is column-major: all rows, then all columns, then all weights.
+    if( binary ) {
+        write_DMAT_binary_values( out, weights.row_indices.data(), weights.nonzeros() );
+        write_DMAT_binary_values( out, columns.data(), weights.nonzeros() );
+        write_DMAT_binary_values( out, weights.values.data(), weights.nonzeros() );
+    } else {
+        const size_t nonzeros = weights.nonzeros();
+        write_text_in_chunks( out, 3 * nonzeros, kTextChunkSize, num_threads, [&]( size_t begin, size_t end, TextWriter& writer ) {
+            for( size_t i = begin; i < end; ++i ) {
+                if( i < nonzeros ) writer.write( (long long)weights.row_indices[i] );
+                else if( i < 2 * nonzeros ) writer.write( (long long)columns[ i - nonzeros ] );
+                else writer.write( weights.values[ i - 2 * nonzeros ] );
+                writer.write( '\n' );
+            }
+        } );
+    }
+}
+
+void save_sparse_weights_to_DMAT( const std::string& filename, const SparseWeights& weights, bool binary = false, int num_threads = 1 ) {
+    /*
+    Saves the given sparse `weights` to the file named `filename` in DMAT format.
+    */
+    
+    std::ofstream out( filename, binary ? std::ios::binary : std::ios::out );
+    if( !out ) {
+        std::cerr << "save_sparse_weights_to_DMAT(): Unable to open file for writing: " << filename << std::endl;
+        return;
+    }
+    
+    save_sparse_weights_to_DMAT( out, weights, binary, num_threads );
+}
+
+void save_rig_streaming( const aiScene* scene, std::vector< aiVector3D >& joints_out, std::vector< std::pair< int, int > >& bones_out, std::ostream& out, bool binary = false, int num_threads = 1, std::vector< int >* weld_remap_out = nullptr )
+{
+    /*
+    Like save_rig() followed by save_weights_to_DMAT( out, ..., binary ),
+    but without ever holding the whole weight matrix in memory.
+    The matrix is column-major, so it is written one bone column at a time,
+    filled directly from the aiBone weights of that bone in every mesh.
+    Only one column (#vertices floats) is kept at once.
+    Welds like save_rig() if `weld_remap_out` isn't null.
+    Step 3 runs on up to `num_threads` threads.
+    */
+    
+    printf( "# Extracting the rig (streaming weights).\n" );
+    
+    assert( scene );
+    assert( scene->mRootNode );
+    // This function doesn't make sense if there aren't any meshes.
+    if( 0 == scene->mNumMeshes ) {
+        std::cerr << "save_rig_streaming(): No meshes means no rig to save." << std::endl;
+        return;
+    }
+    
+    /// 1-4
+    RigLayout layout;
+    std::string error;
+    if( !extract_skeleton( scene, joints_out, bones_out, layout, error, num_threads, nullptr != weld_remap_out ) ) {
+        std::cerr << "save_rig_streaming(): " << error << std::endl;
+        return;
+    }
+    if( weld_remap_out ) *weld_remap_out = layout.weld_remap();
+    const int rows = layout.total_vertex_num;
+    const int cols = bones_out.size();
+    assert( rows > 0 );
+    assert( cols > 0 );
+    
+    /// 5
+    // The mesh bones that make up each column, with the index of their mesh.
+    std::vector< std::vector< std::pair< int, const aiBone* > > > column_bones( cols );
+    for( int mesh_index = 0; mesh_index < int( scene->mNumMeshes ); ++mesh_index ) {
+        const aiMesh* mesh = scene->mMeshes[ mesh_index ];
+        assert( mesh );
+        
+        for( int bone_index = 0; bone_index < int( mesh->mNumBones ); ++bone_index ) {
+            column_bones[ layout.mesh_bone_columns[ mesh_index ][ bone_index ] ].push_back(
+                std::make_pair( mesh_index, mesh->mBones[ bone_index ] ) );
+        }
+    }
+    
+    write_DMAT_header( out, rows, cols, binary );
+    
+    TextWriter writer( out );
+    std::vector< float > column( rows, 0.f );
+    for( const auto& bones : column_bones ) {
+        for( const auto& mesh_and_bone : bones ) {
+            const aiBone* bone = mesh_and_bone.second;
+            for( int weight_index = 0; weight_index < int( bone->mNumWeights ); ++weight_index ) {
+                const aiVertexWeight& weight = bone->mWeights[ weight_index ];
+                const int row = layout.row( mesh_and_bone.first, weight.mVertexId );
+                if( row < 0 ) continue;
+                assert( row < rows );
+                column[ row ] = weight.mWeight;
+            }
+        }
+        
+        if( binary ) {
+            write_DMAT_binary_values( out, column.data(), column.size() );
+        } else {
+            for( const auto& val : column ) {
+                writer.write( val );
+                writer.write( '\n' );
+            }
+        }
+        
+        // Zero what we set, which is much less than the whole column.
+        for( const auto& mesh_and_bone : bones ) {
+            const aiBone* bone = mesh_and_bone.second;
+            for( int weight_index = 0; weight_index < int( bone->mNumWeights ); ++weight_index ) {
+                const int row = layout.row( mesh_and_bone.first, bone->mWeights[ weight_index ].mVertexId );
+                if( row >= 0 ) column[ row ] = 0.f;
+            }
+        }
+    }
+}
+
+void save_rig_streaming( const aiScene* scene, std::vector< aiVector3D >& joints_out, std::vector< std::pair< int, int > >& bones_out, const std::string& weights_filename, bool binary = false, int num_threads = 1, std::vector< int >* weld_remap_out = nullptr )
+{
+    /*
+    Like save_rig_streaming() above, writing the weights to the file named `weights_filename`.
+    */
+    
+    std::ofstream out( weights_filename, binary ? std::ios::binary : std::ios::out );
+    if( !out ) {
+        std::cerr << "save_rig_streaming(): Unable to open file for writing: " << weights_filename << std::endl;
+        return;
+    }
+    
+    save_rig_streaming( scene, joints_out, bones_out, out, binary, num_threads, weld_remap_out );
+}
+
+void save_weld_remap_to_DMAT( std::ostream& out, const std::vector< int >& remap, bool binary = false ) {
+    /*
+    Writes the `remap` of save_rig() (the weight row of each unwelded vertex)
+    to `out` as a #vertices by 1 DMAT.
+    If `binary` is true, uses DMAT's binary variant (see save_weights_to_DMAT()).
+    */
+    
+    write_DMAT_header( out, remap.size(), 1, binary );
+    
+    if( binary ) {
+        write_DMAT_binary_values( out, remap.data(), remap.size() );
+    } else {
+        TextWriter writer( out );
+        for( const auto& row : remap ) { writer.write( (long long)row ); writer.write( '\n' ); }
+    }
+}
+
+namespace
+{
+// Writes a DMAT whose rows are `matrices` (row-major, 16 values each),
+// preceded by the value of `first_column` for each row if it isn't null.
+void save_matrices_to_DMAT( std::ostream& out, const std::vector< aiMatrix4x4 >& matrices, const std::vector< int >* first_column, bool binary ) {
+    assert( !first_column || first_column->size() == matrices.size() );
+    
+    const size_t rows = matrices.size();
+    const size_t cols = ( first_column ? 1 : 0 ) + 16;
+    // DMAT is column-major.
+    std::vector< float > values( rows * cols );
+    for( size_t row = 0; row < rows; ++row ) {
+        size_t col = 0;
+        if( first_column ) values[ col++ * rows + row ] = ( *first_column )[ row ];
+        for( int i = 0; i < 4; ++i ) {
+            for( int j = 0; j < 4; ++j ) values[ col++ * rows + row ] = matrices[ row ][i][j];
+        }
+    }
+    
+    write_DMAT_header( out, rows, cols, binary );
+    if( binary ) {
+        write_DMAT_binary_values( out, values.data(), values.size() );
+    } else {
+        TextWriter writer( out );
+        for( const auto& val : values ) { writer.write( val ); writer.write( '\n' ); }
+    }
+}
+}
+
+void save_rest_pose_to_DMAT( std::ostream& out, const RestPose& pose, bool binary = false ) {
+    /*
+    Writes the joints of `pose` to `out` as a #joints by 17 DMAT:
+    each joint's parent (-1 for a root) and then its local transformation, row-major.
+    If `binary` is true, uses DMAT's binary variant (see save_weights_to_DMAT()).
+    */
+    
+    save_matrices_to_DMAT( out, pose.local_transformations, &pose.parents, binary );
+}
+
+void save_inverse_bind_matrices_to_DMAT( std::ostream& out, const RestPose& pose, bool binary = false ) {
+    /*
+    Writes the inverse bind matrices of `pose` to `out` as a #bones by 16 DMAT,
+    each bone's matrix row-major.
+    If `binary` is true, uses DMAT's binary variant (see save_weights_to_DMAT()).
+    */
+    
+    save_matrices_to_DMAT( out, pose.inverse_bind_matrices, nullptr, binary );
+}
+
+namespace
+{
+void quantize_influences( const float* weights, int rows, int count, int max_value, uint16_t* quantized )
+{
+    /*
+    Normalizes each row's `count` weights (stored slot by slot, as in Influences, largest first) to sum to `max_value`
+    and rounds them to integers, written to `quantized` in the same layout.
+    Each row then sums to exactly `max_value` (or is all 0 if its weights are):
+    a shortfall from rounding goes to slot 0, and a surplus is taken back
+    one from each of the smallest nonzero slots, so the slots stay largest first and none goes below 0.
+    Uses SSE2 for 4 rows at a time when available; the result is the same either way.
+    */
+    
+    // Takes `surplus` back from `row`, one from each of its last nonzero slots.
+    // Each nonzero slot rounded up by at most 1/2, so there are at least twice `surplus` of them.
+    auto take_back = [&]( int row, int surplus ) {
+        for( int slot = count - 1; slot >= 0 && surplus > 0; --slot ) {
+            uint16_t& q = quantized[ size_t( slot )*rows + row ];
+            if( q > 0 ) {
+                --q;
+                --surplus;
+            }
+        }
+        assert( 0 == surplus );
+    };
+    
+    int row = 0;
+#if defined( __SSE2__ )
+    const __m128 max_value4 = _mm_set1_ps( float( max_value ) );
+    const __m128i max_value4i = _mm_set1_epi32( max_value );
+    const __m128i bias = _mm_set1_epi32( 32768 );
+    const __m128i flip = _mm_set1_epi16( short( 0x8000 ) );
+    // Stores the 4 values (each in [0,65535]) of `q` as uint16_t.
+    // _mm_packs_epi32() saturates to signed 16-bit values, so shift them down by 32768 first and flip the sign bit back.
+    auto store = [&]( uint16_t* destination, __m128i q ) {
+        const __m128i packed = _mm_xor_si128( _mm_packs_epi32( _mm_sub_epi32( q, bias ), _mm_setzero_si128() ), flip );
+        _mm_storel_epi64( reinterpret_cast< __m128i* >( destination ), packed );
+    };
+    
+    for( ; row + 4 <= rows; row += 4 ) {
+        __m128 sum = _mm_setzero_ps();
+        for( int slot = 0; slot < count; ++slot ) sum = _mm_add_ps( sum, _mm_loadu_ps( weights + size_t( slot )*rows + row ) );
+        
+        const __m128 is_weighted = _mm_cmpgt_ps( sum, _mm_setzero_ps() );
+        // Rows without weights would divide by zero; their weights are all 0 anyway.
+        const __m128 scale = _mm_and_ps( is_weighted, _mm_div_ps( max_value4, _mm_or_ps( sum, _mm_andnot_ps( is_weighted, _mm_set1_ps( 1.f ) ) ) ) );
+        
+        __m128i total = _mm_setzero_si128();
+        __m128i first = _mm_setzero_si128();
+        for( int slot = 0; slot < count; ++slot ) {
+            // Rounds to nearest (even), like lrintf() below.
+            const __m128i q = _mm_cvtps_epi32( _mm_mul_ps( _mm_loadu_ps( weights + size_t( slot )*rows + row ), scale ) );
+            total = _mm_add_epi32( total, q );
+            if( 0 == slot ) first = q;
+            else store( quantized + size_t( slot )*rows + row, q );
+        }
+        
+        // The shortfall of each weighted row: positive ones go to slot 0, negative ones are taken back below.
+        const __m128i shortfall = _mm_and_si128( _mm_castps_si128( is_weighted ), _mm_sub_epi32( max_value4i, total ) );
+        const __m128i positive = _mm_cmpgt_epi32( shortfall, _mm_setzero_si128() );
+        store( quantized + row, _mm_add_epi32( first, _mm_and_si128( positive, shortfall ) ) );
+        
+        alignas( 16 ) int32_t shortfalls[4];
+        _mm_store_si128( reinterpret_cast< __m128i* >( shortfalls ), shortfall );
+        for( int i = 0; i < 4; ++i ) {
+            if( shortfalls[i] < 0 ) take_back( row + i, -shortfalls[i] );
+        }
+    }
+#endif
+    
+    for( ; row < rows; ++row ) {
+        float sum = 0.f;
+        for( int slot = 0; slot < count; ++slot ) sum += weights[ size_t( slot )*rows + row ];
+        
+        const float scale = sum > 0.f ? float( max_value ) / sum : 0.f;
+        
+        int total = 0;
+        for( int slot = 0; slot < count; ++slot ) {
+            const int q = lrintf( weights[ size_t( slot )*rows + row ] * scale );
+            total += q;
+            quantized[ size_t( slot )*rows + row ] = q;
+        }
+        
+        const int shortfall = sum > 0.f ? max_value - total : 0;
+        if( shortfall > 0 ) quantized[ row ] += shortfall;
+        else if( shortfall < 0 ) take_back( row, -shortfall );
+    }
+}
+}
+
+void save_influences_to_SKIN( std::ostream& out, const Influences& influences, int weight_bits = 8 ) {
+    /*
+    Writes the given `influences`, normalized to sum to 1 and quantized to `weight_bits` (8 or 16) bits,
+    to `out` as a compact binary stream ready to upload to a GPU.
+    All numbers are little-endian.
+    
+    SKIN format:
+        A 16-byte header:
+            char[4] magic: "SKIN"
+            uint32 version: 1
+            uint32 vertices: the number of vertices (rows)
+            uint8 influences: the number of influences per vertex (K)
+            uint8 index_bytes: 1 if there are at most 256 bones, 2 if at most 65536, otherwise 4
+            uint8 weight_bytes: 1 or 2
+            uint8 reserved: 0
+        Then for each vertex, interleaved:
+            K bone indices (index_bytes each): 0-indexed bones of the TGF file, largest weight first
+            K weights (weight_bytes each): summing to exactly 255 (or 65535)
+        Unused influences have bone 0 and weight 0.
+    */
+    
+    assert( 8 == weight_bits || 16 == weight_bits );
+    
+    const int rows = influences.rows;
+    const int count = influences.count;
+    const int index_bytes = influences.cols <= 256 ? 1 : ( influences.cols <= 65536 ? 2 : 4 );
+    const int weight_bytes = weight_bits / 8;
+    
+    std::vector< uint16_t > quantized( influences.weights.size() );
+    quantize_influences( influences.weights.data(), rows, count, ( 1 << weight_bits ) - 1, quantized.data() );
+    
+    const unsigned char header[16] = {
+        'S', 'K', 'I', 'N',
+        1, 0, 0, 0,
+        (unsigned char)( rows ), (unsigned char)( rows >> 8 ), (unsigned char)( rows >> 16 ), (unsigned char)( rows >> 24 ),
+        (unsigned char)( count ), (unsigned char)( index_bytes ), (unsigned char)( weight_bytes ), 0
+        };
+    out.write( reinterpret_cast< const char* >( header ), sizeof( header ) );
+    
+    // Interleave a large block of vertices at a time.
+    const size_t vertex_bytes = count * ( index_bytes + weight_bytes );
+    const int kBlockRows = 1 << 16;
+    std::vector< unsigned char > block( std::min( rows, kBlockRows ) * vertex_bytes );
+    auto put = []( unsigned char*& p, int val, int bytes ) {
+        for( int byte = 0; byte < bytes; ++byte ) *p++ = ( val >> ( 8*byte ) ) & 0xFF;
+    };
+    for( int start = 0; start < rows; start += kBlockRows ) {
+        const int end = std::min( rows, start + kBlockRows );
+        unsigned char* p = block.data();
+        for( int row = start; row < end; ++row ) {
+            for( int slot = 0; slot < count; ++slot ) put( p, influences.bones[ size_t( slot )*rows + row ], index_bytes );
+            for( int slot = 0; slot < count; ++slot ) put( p, quantized[ size_t( slot )*rows + row ], weight_bytes );
+        }
+        out.write( reinterpret_cast< const char* >( block.data() ), p - block.data() );
+    }
+}
+
+// Collects the sections of a .rig file and writes them. See rig_file.h for the format.
+// Sections point at the caller's values, which must outlive write().
+class RigFileWriter
+{
+public:
+    void add( uint32_t tag, const float* values, size_t rows, size_t cols ) { add( tag, rig_file::kFloat32, values, rows, cols ); }
+    void add( uint32_t tag, const int32_t* values, size_t rows, size_t cols ) { add( tag, rig_file::kInt32, values, rows, cols ); }
+    
+    // Adds the joints and bones of save_rig() and the parent of each joint, which are copied.
+    void add_skeleton( const std::vector< aiVector3D >& joints, const std::vector< std::pair< int, int > >& bones ) {
+        m_joints.clear();
+        for( const auto& position : joints ) {
+            m_joints.push_back( position.x );
+            m_joints.push_back( position.y );
+            m_joints.push_back( position.z );
+        }
+        m_bones.clear();
+        m_parents.assign( joints.size(), -1 );
+        for( const auto& bone : bones ) {
+            m_bones.push_back( bone.first );
+            m_bones.push_back( bone.second );
+            m_parents[ bone.second ] = bone.first;
+        }
+        
+        m_header_joints = joints.size();
+        m_header_bones = bones.size();
+        // Each joint's x y z (and each bone's start and end) are a column, so they are together.
+        add( rig_file::kJoints, m_joints.data(), 3, joints.size() );
+        add( rig_file::kBones, m_bones.data(), 2, bones.size() );
+        add( rig_file::kParents, m_parents.data(), joints.size(), 1 );
+    }
+    
+    // Adds the local transformations and inverse bind matrices of `pose` (with the same joints and bones as add_skeleton()'s).
+    // They are copied as floats, since ai_real is a double when ASSIMP is built with ASSIMP_DOUBLE_PRECISION.
+    void add_rest_pose( const RestPose& pose ) {
+        // Each matrix is a column of its 16 values, row-major.
+        auto copy_matrices = []( const std::vector< aiMatrix4x4 >& matrices, std::vector< float >& values ) {
+            values.clear();
+            for( const auto& matrix : matrices ) values.insert( values.end(), &matrix.a1, &matrix.a1 + 16 );
+        };
+        copy_matrices( pose.local_transformations, m_rest_pose );
+        copy_matrices( pose.inverse_bind_matrices, m_inverse_bind_matrices );
+        add( rig_file::kRestPose, m_rest_pose.data(), 16, pose.local_transformations.size() );
+        add( rig_file::kInverseBindMatrices, m_inverse_bind_matrices.data(), 16, pose.inverse_bind_matrices.size() );
+    }
+    
+    // Adds save_rig()'s `rows` by `cols` weight matrix.
+    void add_weights( int rows, int cols, const std::vector< float >& weights ) {
+        assert( size_t( rows ) * cols == weights.size() );
+        m_header_vertices = rows;
+        add( rig_file::kDenseWeights, weights.data(), rows, cols );
+    }
+    
+    // Adds save_rig_sparse()'s weight matrix.
+    void add_weights( const SparseWeights& weights ) {
+        m_header_vertices = weights.rows;
+        add( rig_file::kSparseWeightColumnStarts, weights.column_starts.data(), weights.column_starts.size(), 1 );
+        add( rig_file::kSparseWeightRows, weights.row_indices.data(), weights.nonzeros(), 1 );
+        add( rig_file::kSparseWeightValues, weights.values.data(), weights.nonzeros(), 1 );
+    }
+    
+    void write( std::ostream& out ) const {
+        const uint64_t table_end = sizeof( rig_file::Header ) + m_sections.size() * sizeof( rig_file::Section );
+        
+        // Lay out the sections one after the other, each aligned.
+        std::vector< rig_file::Section > table( m_sections.size() );
+        uint64_t end = table_end;
+        for( size_t i = 0; i < m_sections.size(); ++i ) {
+            end = align( end );
+            table[i].tag = m_sections[i].tag;
+            table[i].type = m_sections[i].type;
+            table[i].offset = end;
+            table[i].rows = m_sections[i].rows;
+            table[i].cols = m_sections[i].cols;
+            end += bytes( m_sections[i] );
+        }
+        
+        rig_file::Header header;
+        memcpy( header.magic, rig_file::kMagic, sizeof( header.magic ) );
+        header.version = rig_file::kVersion;
+        header.header_size = sizeof( rig_file::Header );
+        header.section_count = m_sections.size();
+        header.vertices = m_header_vertices;
+        header.joints = m_header_joints;
+        header.bones = m_header_bones;
+        header.file_size = end;
+        header.reserved = 0;
+        
+        out.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+        out.write( reinterpret_cast< const char* >( table.data() ), table.size() * sizeof( rig_file::Section ) );
+        
+        uint64_t position = table_end;
+        const char padding[ rig_file::kAlignment ] = {};
+        for( size_t i = 0; i < m_sections.size(); ++i ) {
+            out.write( padding, table[i].offset - position );
+            out.write( static_cast< const char* >( m_sections[i].values ), bytes( m_sections[i] ) );
+            position = table[i].offset + bytes( m_sections[i] );
+        }
+    }
+    
+private:
+    struct Section
+    {
+        uint32_t tag;
+        uint32_t type;
+        const void* values;
+        uint32_t rows;
+        uint32_t cols;
+    };
+    
+    void add( uint32_t tag, uint32_t type, const void* values, size_t rows, size_t cols ) {
+        const Section section = { tag, type, values, uint32_t( rows ), uint32_t( cols ) };
+        m_sections.push_back( section );
+    }
+    
+    static uint64_t align( uint64_t offset ) { return ( offset + rig_file::kAlignment - 1 ) / rig_file::kAlignment * rig_file::kAlignment; }
+    // Both types are 4 bytes.
+    static uint64_t bytes( const Section& section ) { return uint64_t( section.rows ) * section.cols * 4; }
+    
+    std::vector< Section > m_sections;
+    std::vector< float > m_joints;
+    std::vector< int32_t > m_bones;
+    std::vector< int32_t > m_parents;
+    std::vector< float > m_rest_pose;
+    std::vector< float > m_inverse_bind_matrices;
+    uint32_t m_header_vertices = 0;
+    uint32_t m_header_joints = 0;
+    uint32_t m_header_bones = 0;
+};
+
+namespace
+{
+// Finds the keys around `time` among the `count` (at least one) keys of an animation channel:
+// sets `previous` and `next` to their indices and `t` to how far `time` is between them.
+// Before the first key and after the last, holds the first or last key.
+template< typename Key >
+void find_keys( const Key* keys, unsigned int count, double time, unsigned int& previous, unsigned int& next, ai_real& t ) {
+    assert( count > 0 );
+    // The first key after `time`.
+    next = std::upper_bound( keys, keys + count, time, []( double time, const Key& key ) { return time < key.mTime; } ) - keys;
+    if( 0 == next || count == next ) {
+        previous = next = ( 0 == next ) ? 0 : count - 1;
+        t = 0;
+        return;
+    }
+    previous = next - 1;
+    t = ai_real( ( time - keys[ previous ].mTime ) / ( keys[ next ].mTime - keys[ previous ].mTime ) );
+}
+
+aiVector3D interpolate_keys( const aiVectorKey* keys, unsigned int count, double time ) {
+    unsigned int previous, next;
+    ai_real t;
+    find_keys( keys, count, time, previous, next, t );
+    return keys[ previous ].mValue + ( keys[ next ].mValue - keys[ previous ].mValue ) * t;
+}
+
+aiQuaternion interpolate_keys( const aiQuatKey* keys, unsigned int count, double time ) {
+    unsigned int previous, next;
+    ai_real t;
+    find_keys( keys, count, time, previous, next, t );
+    aiQuaternion rotation;
+    aiQuaternion::Interpolate( rotation, keys[ previous ].mValue, keys[ next ].mValue, t );
+    return rotation;
+}
+
+// Samples an animation's channels into the local transformations of the nodes of a hierarchy.
+class AnimationSampler
+{
+public:
+    AnimationSampler( const aiAnimation* animation, const NodeHierarchy& hierarchy ) : m_animation( animation ), m_hierarchy( hierarchy ) {
+        assert( animation );
+        // ASSIMP leaves this 0 when the file doesn't say.
+        m_ticks_per_second = animation->mTicksPerSecond > 0. ? animation->mTicksPerSecond : 25.;
+        
+        // A channel without keys for one of scaling, rotation, or position keeps the node's own.
+        m_channel_nodes.assign( animation->mNumChannels, -1 );
+        m_rest_scalings.resize( animation->mNumChannels );
+        m_rest_rotations.resize( animation->mNumChannels );
+        m_rest_positions.resize( animation->mNumChannels );
+        for( unsigned int channel = 0; channel < animation->mNumChannels; ++channel ) {
+            const auto found = hierarchy.name_to_id.find( animation->mChannels[ channel ]->mNodeName.C_Str() );
+            if( found == hierarchy.name_to_id.end() ) continue;
+            m_channel_nodes[ channel ] = found->second;
+            hierarchy.nodes[ found->second ]->mTransformation.Decompose( m_rest_scalings[ channel ], m_rest_rotations[ channel ], m_rest_positions[ channel ] );
+        }
+    }
+    
+    // The length of the animation, in seconds.
+    double duration_seconds() const { return std::max( m_animation->mDuration, 0. ) / m_ticks_per_second; }
+    
+    int num_channels() const { return m_channel_nodes.size(); }
+    // The node id of `channel`, or -1 if the hierarchy has no node with its name.
+    int channel_node( int channel ) const { return m_channel_nodes[ channel ]; }
+    
+    // The scaling, rotation, and position of `channel` at `seconds` into the animation.
+    void sample_channel( int channel, double seconds, aiVector3D& scaling, aiQuaternion& rotation, aiVector3D& position ) const {
+        const aiNodeAnim* keys = m_animation->mChannels[ channel ];
+        const double time = seconds * m_ticks_per_second;
+        scaling = keys->mNumScalingKeys ? interpolate_keys( keys->mScalingKeys, keys->mNumScalingKeys, time ) : m_rest_scalings[ channel ];
+        rotation = keys->mNumRotationKeys ? interpolate_keys( keys->mRotationKeys, keys->mNumRotationKeys, time ) : m_rest_rotations[ channel ];
+        position = keys->mNumPositionKeys ? interpolate_keys( keys->mPositionKeys, keys->mNumPositionKeys, time ) : m_rest_positions[ channel ];
+    }
+    
+    // Fills `local_transformations` with each node's transformation relative to its parent at `seconds` into the animation:
+    // its channel's, or its own aiNode::mTransformation if it has no channel.
+    void sample( double seconds, std::vector< aiMatrix4x4 >& local_transformations ) const {
+        local_transformations.resize( m_hierarchy.size() );
+        for( int node = 0; node < m_hierarchy.size(); ++node ) local_transformations[ node ] = m_hierarchy.nodes[ node ]->mTransformation;
+        
+        for( int channel = 0; channel < num_channels(); ++channel ) {
+            if( m_channel_nodes[ channel ] < 0 ) continue;
+            aiVector3D scaling, position;
+            aiQuaternion rotation;
+            sample_channel( channel, seconds, scaling, rotation, position );
+            local_transformations[ m_channel_nodes[ channel ] ] = aiMatrix4x4( scaling, rotation, position );
+        }
+    }
+    
+private:
+    const aiAnimation* m_animation;
+    const NodeHierarchy& m_hierarchy;
+    double m_ticks_per_second;
+    std::vector< int > m_channel_nodes;
+    std::vector< aiVector3D > m_rest_scalings;
+    std::vector< aiQuaternion > m_rest_rotations;
+    std::vector< aiVector3D > m_rest_positions;
+};
+
+// Accumulates `local_transformations` (one per node of `hierarchy`) into each node's transformation to the scene's space.
+void accumulate_transformations( const NodeHierarchy& hierarchy, const std::vector< aiMatrix4x4 >& local_transformations, std::vector< aiMatrix4x4 >& global_transformations ) {
+    global_transformations.resize( hierarchy.size() );
+    // Parents come before their children.
+    for( int node = 0; node < hierarchy.size(); ++node ) {
+        const int parent = hierarchy.parents[ node ];
+        global_transformations[ node ] = parent < 0 ? local_transformations[ node ] : global_transformations[ parent ] * local_transformations[ node ];
+    }
+}
+
+// Skins `count` vertices at `positions` with linear blend skinning: each vertex's position is
+// the sum over the slots of its row of the influences of the weight times the bone's matrix times its position.
+// `palette` has each bone's skinning matrix as 12 floats (the top three rows, row-major).
+// The row of vertex `i` is vertex_rows[i], or `i` if `vertex_rows` is null.
+// Uses SSE2 when available; the result is the same either way.
+void skin_vertices( const float* palette, const Influences& influences, const int* vertex_rows, const aiVector3D* positions, size_t count, aiVector3D* skinned ) {
+    for( size_t vertex = 0; vertex < count; ++vertex ) {
+        const size_t row = vertex_rows ? vertex_rows[ vertex ] : vertex;
+        const aiVector3D& position = positions[ vertex ];
+        
+#if defined( __SSE2__ )
+        // Blend the matrices' rows, then multiply the blended matrix by the position.
+        __m128 row0 = _mm_setzero_ps(), row1 = _mm_setzero_ps(), row2 = _mm_setzero_ps();
+        for( int slot = 0; slot < influences.count; ++slot ) {
+            const size_t i = size_t( slot )*influences.rows + row;
+            const __m128 weight = _mm_set1_ps( influences.weights[i] );
+            const float* matrix = palette + 12*influences.bones[i];
+            row0 = _mm_add_ps( row0, _mm_mul_ps( weight, _mm_loadu_ps( matrix ) ) );
+            row1 = _mm_add_ps( row1, _mm_mul_ps( weight, _mm_loadu_ps( matrix + 4 ) ) );
+            row2 = _mm_add_ps( row2, _mm_mul_ps( weight, _mm_loadu_ps( matrix + 8 ) ) );
+        }
+        
+        const __m128 point = _mm_setr_ps( position.x, position.y, position.z, 1.f );
+        __m128 x = _mm_mul_ps( row0, point ), y = _mm_mul_ps( row1, point ), z = _mm_mul_ps( row2, point ), w = _mm_setzero_ps();
+        // After transposing, adding the four gives the three rows' dot products.
+        _MM_TRANSPOSE4_PS( x, y, z, w );
+        float result[4];
+        _mm_storeu_ps( result, _mm_add_ps( _mm_add_ps( _mm_add_ps( x, y ), z ), w ) );
+        skinned[ vertex ] = aiVector3D( result[0], result[1], result[2] );
+#else
+        float blended[12] = {};
+        for( int slot = 0; slot < influences.count; ++slot ) {
+            const size_t i = size_t( slot )*influences.rows + row;
+            const float weight = influences.weights[i];
+            const float* matrix = palette + 12*influences.bones[i];
+            for( int j = 0; j < 12; ++j ) blended[j] += weight * matrix[j];
+        }
+        
+        const float point[4] = { position.x, position.y, position.z, 1.f };
+        float result[3];
+        for( int r = 0; r < 3; ++r ) result[r] = blended[ 4*r ]*point[0] + blended[ 4*r + 1 ]*point[1] + blended[ 4*r + 2 ]*point[2] + blended[ 4*r + 3 ]*point[3];
+        skinned[ vertex ] = aiVector3D( result[0], result[1], result[2] );
+#endif
+    }
+}
+}
+
+void influences_from_weights( int rows, int cols, const std::vector< float >& weights, Influences& influences_out ) {
+    /*
+    Fills `influences_out` with the nonzeros of each row of save_rig()'s `rows` by `cols` weight matrix,
+    with as many slots as the row with the most.
+    Unlike save_rig_influences(), the slots are in bone order rather than largest first.
+    */
+    
+    assert( size_t( rows ) * cols == weights.size() );
+    
+    std::vector< int > row_counts( rows, 0 );
+    for( size_t i = 0; i < weights.size(); ++i ) {
+        if( 0.f != weights[i] ) row_counts[ i % rows ] += 1;
+    }
+    
+    influences_out.rows = rows;
+    influences_out.cols = cols;
+    influences_out.count = rows ? *std::max_element( row_counts.begin(), row_counts.end() ) : 0;
+    influences_out.weights.assign( size_t( influences_out.count ) * rows, 0.f );
+    influences_out.bones.assign( size_t( influences_out.count ) * rows, 0 );
+    
+    std::fill( row_counts.begin(), row_counts.end(), 0 );
+    for( int col = 0; col < cols; ++col ) {
+        for( int row = 0; row < rows; ++row ) {
+            const float weight = weights[ size_t( col )*rows + row ];
+            if( 0.f == weight ) continue;
+            const size_t i = size_t( row_counts[ row ]++ )*rows + row;
+            influences_out.weights[i] = weight;
+            influences_out.bones[i] = col;
+        }
+    }
+}
+
+void influences_from_weights( const SparseWeights& weights, Influences& influences_out ) {
+    /*
+    Like the dense influences_from_weights(), for save_rig_sparse()'s weight matrix.
+    */
+    
+    std::vector< int > row_counts( weights.rows, 0 );
+    for( const int row : weights.row_indices ) row_counts[ row ] += 1;
+    
+    influences_out.rows = weights.rows;
+    influences_out.cols = weights.cols;
+    influences_out.count = weights.rows ? *std::max_element( row_counts.begin(), row_counts.end() ) : 0;
+    influences_out.weights.assign( size_t( influences_out.count ) * weights.rows, 0.f );
+    influences_out.bones.assign( size_t( influences_out.count ) * weights.rows, 0 );
+    
+    std::fill( row_counts.begin(), row_counts.end(), 0 );
+    for( int col = 0; col < weights.cols; ++col ) {
+        for( int k = weights.column_starts[ col ]; k < weights.column_starts[ col + 1 ]; ++k ) {
+            const int row = weights.row_indices[k];
+            const size_t i = size_t( row_counts[ row ]++ )*weights.rows + row;
+            influences_out.weights[i] = weights.values[k];
+            influences_out.bones[i] = col;
+        }
+    }
+}
+
+void dequantize_influences( const Influences& influences, int weight_bits, Influences& dequantized_out ) {
+    /*
+    Fills `dequantized_out` with `influences` as save_influences_to_SKIN() saves them:
+    normalized and quantized to `weight_bits` bits, then scaled back to sum to 1.
+    */
+    
+    const int max_value = ( 1 << weight_bits ) - 1;
+    std::vector< uint16_t > quantized( influences.weights.size() );
+    quantize_influences( influences.weights.data(), influences.rows, influences.count, max_value, quantized.data() );
+    
+    dequantized_out = influences;
+    for( size_t i = 0; i < quantized.size(); ++i ) dequantized_out.weights[i] = float( quantized[i] ) / max_value;
+}
+
+struct SkinningError
+{
+    // The largest and mean distance between a vertex skinned with ASSIMP's data and with the exported rig.
+    double max = 0.;
+    double mean = 0.;
+    // The number of poses compared: the rest pose and the sampled frames of each animation.
+    int poses = 0;
+};
+
+void verify_skinning( const aiScene* scene, const std::vector< std::pair< int, int > >& bones, const RestPose& pose, const Influences& influences, const std::vector< int >& weld_remap, SkinningError& error_out, int frames_per_animation = 4, int num_threads = 1 )
+{
+    /*
+    Checks that the exported rig (`bones`, `pose`, and the weight matrix's rows as `influences`,
+    with `weld_remap` if it was welded) deforms the meshes the way ASSIMP's own data does.
+    For the rest pose and `frames_per_animation` frames spread over each animation,
+    skins every vertex twice: once straight from the scene (each aiBone's weights and
+    aiBone::mOffsetMatrix, and the node hierarchy's transformations), and once from
+    the exported rig (forward kinematics from the joints' local transformations and
+    the inverse bind matrices, then linear blend skinning with skin_vertices()).
+    Fills `error_out` with the distances between the two.
+    Skinning runs on up to `num_threads` threads.
+    */
+    
+    assert( scene );
+    assert( scene->mRootNode );
+    assert( pose.parents.size() == pose.names.size() );
+    
+    NodeHierarchy hierarchy;
+    flatten_hierarchy( scene->mRootNode, hierarchy );
+    
+    // The node of each joint.
+    std::vector< int > joint_nodes( pose.names.size() );
+    for( size_t joint = 0; joint < pose.names.size(); ++joint ) joint_nodes[ joint ] = hierarchy.name_to_id.at( pose.names[ joint ] );
+    
+    // The flattened vertices.
+    std::vector< aiVector3D > positions;
+    for( int mesh_index = 0; mesh_index < int( scene->mNumMeshes ); ++mesh_index ) {
+        const aiMesh* mesh = scene->mMeshes[ mesh_index ];
+        positions.insert( positions.end(), mesh->mVertices, mesh->mVertices + mesh->mNumVertices );
+    }
+    assert( weld_remap.empty() || weld_remap.size() == positions.size() );
+    const int* const vertex_rows = weld_remap.empty() ? nullptr : weld_remap.data();
+    
+    std::vector< aiVector3D > expected( positions.size() );
+    std::vector< aiVector3D > skinned( positions.size() );
+    std::vector< aiMatrix4x4 > local_transformations;
+    std::vector< aiMatrix4x4 > global_transformations;
+    std::vector< aiMatrix4x4 > joint_transformations( pose.names.size() );
+    std::vector< float > palette( 12 * bones.size() );
+    double sum = 0.;
+    error_out = SkinningError();
+    
+    // Compares the two skinnings with the nodes' transformations in `local_transformations` (null for the rest pose).
+    auto compare = [&]( const std::vector< aiMatrix4x4 >* local_transformations ) {
+        if( local_transformations ) accumulate_transformations( hierarchy, *local_transformations, global_transformations );
+        else global_transformations = hierarchy.transformations;
+        
+        /// Skin with ASSIMP's data.
+        std::fill( expected.begin(), expected.end(), aiVector3D() );
+        size_t first_vertex = 0;
+        for( int mesh_index = 0; mesh_index < int( scene->mNumMeshes ); ++mesh_index ) {
+            const aiMesh* mesh = scene->mMeshes[ mesh_index ];
+            for( int bone_index = 0; bone_index < int( mesh->mNumBones ); ++bone_index ) {
+                const aiBone* bone = mesh->mBones[ bone_index ];
+                const aiMatrix4x4 matrix = global_transformations[ hierarchy.name_to_id.at( bone->mName.C_Str() ) ] * bone->mOffsetMatrix;
+                for( int weight_index = 0; weight_index < int( bone->mNumWeights ); ++weight_index ) {
+                    const aiVertexWeight& weight = bone->mWeights[ weight_index ];
+                    expected[ first_vertex + weight.mVertexId ] += ( matrix * mesh->mVertices[ weight.mVertexId ] ) * weight.mWeight;
+                }
+            }
+            first_vertex += mesh->mNumVertices;
+        }
+        
+        /// Skin with the exported rig.
+        // Joints come after their parents, so one pass does forward kinematics.
+        // A root has no parent joint to be relative to, so an animation moves it with its node.
+        for( size_t joint = 0; joint < pose.parents.size(); ++joint ) {
+            const int parent = pose.parents[ joint ];
+            const aiMatrix4x4& local = local_transformations ? ( parent < 0 ? global_transformations[ joint_nodes[ joint ] ] : ( *local_transformations )[ joint_nodes[ joint ] ] ) : pose.local_transformations[ joint ];
+            joint_transformations[ joint ] = parent < 0 ? local : joint_transformations[ parent ] * local;
+        }
+        for( size_t bone = 0; bone < bones.size(); ++bone ) {
+            const aiMatrix4x4 matrix = joint_transformations[ bones[ bone ].second ] * pose.inverse_bind_matrices[ bone ];
+            std::copy( &matrix.a1, &matrix.a1 + 12, &palette[ 12 * bone ] );
+        }
+        
+        const size_t kChunkSize = 4096;
+        const size_t num_chunks = ( positions.size() + kChunkSize - 1 ) / kChunkSize;
+        parallel_for( num_chunks, clamp_threads( num_threads, num_chunks ), [&]( int chunk, int ) {
+            const size_t begin = chunk * kChunkSize;
+            skin_vertices( palette.data(), influences, vertex_rows ? vertex_rows + begin : nullptr, positions.data() + begin, std::min( kChunkSize, positions.size() - begin ), skinned.data() + begin );
+        } );
+        
+        for( size_t vertex = 0; vertex < positions.size(); ++vertex ) {
+            const double distance = ( skinned[ vertex ] - expected[ vertex ] ).Length();
+            error_out.max = std::max( error_out.max, distance );
+            sum += distance;
+        }
+        error_out.poses += 1;
+    };
+    
+    compare( nullptr );
+    
+    for( int animation_index = 0; animation_index < int( scene->mNumAnimations ); ++animation_index ) {
+        const AnimationSampler sampler( scene->mAnimations[ animation_index ], hierarchy );
+        for( int frame = 0; frame < frames_per_animation; ++frame ) {
+            const double seconds = frames_per_animation > 1 ? sampler.duration_seconds() * frame / ( frames_per_animation - 1 ) : 0.;
+            sampler.sample( seconds, local_transformations );
+            compare( &local_transformations );
+        }
+    }
+    
+    if( !positions.empty() ) error_out.mean = sum / ( double( positions.size() ) * error_out.poses );
+}
+
+struct AnimationClip
+{
+    // An animation sampled at a fixed rate into each joint's transformation relative to its parent joint
+    // (like RestPose::local_transformations), with only the keys that interpolation can't reproduce kept.
+    struct Track
+    {
+        // The frame of each kept key, increasing. The first is frame 0 and, unless the track has only one key, the last is the last frame.
+        std::vector< uint16_t > frames;
+        // The values of each key: 3 floats for translations and scalings,
+        // 4 snorm16s (x y z w, each the component times 32767) for rotations.
+        std::vector< float > values;
+        std::vector< int16_t > rotations;
+    };
+    struct JointTracks
+    {
+        Track translation;
+        Track rotation;
+        Track scaling;
+    };
+    
+    std::string name;
+    double duration_seconds = 0.;
+    double frames_per_second = 0.;
+    int frames = 0;
+    // The tracks of each joint, in the order of save_rig()'s joints_out.
+    std::vector< JointTracks > joints;
+};
+
+namespace
+{
+// Returns the frames to keep of a track of `frames` values with `size` floats each, so that
+// interpolating linearly between the kept frames (and normalizing, if `normalize`) reproduces
+// every frame to within `tolerance` in each component.
+// Greedy: each kept frame is followed by the furthest frame (at most kMaxKeySpan later) that still reproduces the ones between.
+// Checking a span takes time proportional to its length, so the limit keeps long, smooth tracks fast.
+const int kMaxKeySpan = 256;
+std::vector< uint16_t > reduce_keys( const float* values, int frames, int size, float tolerance, bool normalize ) {
+    assert( frames > 0 );
+    assert( size <= 4 );
+    
+    std::vector< uint16_t > kept( 1, 0 );
+    
+    // A constant track needs only one key.
+    bool constant = true;
+    for( int frame = 1; frame < frames && constant; ++frame ) {
+        for( int i = 0; i < size; ++i ) constant = constant && std::fabs( values[ frame*size + i ] - values[i] ) <= tolerance;
+    }
+    if( constant ) return kept;
+    
+    // Whether interpolating from frame `start` to frame `end` reproduces the frames between.
+    auto reproduces = [&]( int start, int end ) {
+        for( int frame = start + 1; frame < end; ++frame ) {
+            const float t = float( frame - start ) / ( end - start );
+            float interpolated[4];
+            float norm = 0.f;
+            for( int i = 0; i < size; ++i ) {
+                interpolated[i] = values[ start*size + i ] + ( values[ end*size + i ] - values[ start*size + i ] ) * t;
+                norm += interpolated[i] * interpolated[i];
+            }
+            const float scale = normalize && norm > 0.f ? 1.f / std::sqrt( norm ) : 1.f;
+            for( int i = 0; i < size; ++i ) {
+                if( std::fabs( interpolated[i] * scale - values[ frame*size + i ] ) > tolerance ) return false;
+            }
+        }
+        return true;
+    };
+    
+    for( int start = 0; start < frames - 1; ) {
+        int end = start + 1;
+        while( end + 1 < frames && end + 1 - start <= kMaxKeySpan && reproduces( start, end + 1 ) ) ++end;
+        kept.push_back( end );
+        start = end;
+    }
+    return kept;
+}
+
+// Fills `track` with the kept frames of the `frames` values (with `size` floats each) of a sampled track.
+void bake_track( const std::vector< float >& values, int frames, int size, float tolerance, bool is_rotation, AnimationClip::Track& track ) {
+    track.frames = reduce_keys( values.data(), frames, size, tolerance, is_rotation );
+    for( const int frame : track.frames ) {
+        for( int i = 0; i < size; ++i ) {
+            const float value = values[ frame*size + i ];
+            if( is_rotation ) track.rotations.push_back( int16_t( lrintf( std::max( -1.f, std::min( 1.f, value ) ) * 32767.f ) ) );
+            else track.values.push_back( value );
+        }
+    }
+}
+}
+
+bool save_animations( const aiScene* scene, std::vector< AnimationClip >& clips_out, double frames_per_second = 30., float tolerance = 1e-4f, int num_threads = 1, std::string* error = nullptr )
+{
+    /*
+    Samples each of the scene's animations `frames_per_second` times a second into `clips_out`:
+    for each joint of save_rig()'s skeleton, its transformation relative to its parent joint
+    (or to the scene, for a root), split into translation, rotation, and scaling tracks.
+    Keys that linear interpolation (normalized, for rotations) reproduces to within `tolerance`
+    are dropped, and rotations are quantized to 16 bits per component.
+    Joints are baked on up to `num_threads` threads.
+    Returns false (and sets `*error` if it isn't null) if an animation is too long to bake at that rate.
+    */
+    
+    assert( scene );
+    assert( scene->mRootNode );
+    assert( frames_per_second > 0. );
+    
+    clips_out.clear();
+    
+    RestPose pose;
+    save_rest_pose( scene, pose );
+    NodeHierarchy hierarchy;
+    flatten_hierarchy( scene->mRootNode, hierarchy );
+    std::vector< int > joint_nodes( pose.names.size() );
+    for( size_t joint = 0; joint < pose.names.size(); ++joint ) joint_nodes[ joint ] = hierarchy.name_to_id.at( pose.names[ joint ] );
+    const int num_joints = joint_nodes.size();
+    
+    std::vector< aiMatrix4x4 > local_transformations;
+    std::vector< aiMatrix4x4 > global_transformations;
+    for( int animation_index = 0; animation_index < int( scene->mNumAnimations ); ++animation_index ) {
+        const aiAnimation* animation = scene->mAnimations[ animation_index ];
+        const AnimationSampler sampler( animation, hierarchy );
+        
+        AnimationClip clip;
+        clip.name = animation->mName.C_Str();
+        clip.duration_seconds = sampler.duration_seconds();
+        clip.frames_per_second = frames_per_second;
+        clip.frames = int( std::ceil( clip.duration_seconds * frames_per_second - 1e-6 ) ) + 1;
+        if( clip.frames > 65536 ) {
+            if( error ) *error = "The animation is too long to bake at this frame rate: " + clip.name;
+            return false;
+        }
+        
+        /// Sample each joint's transformation at every frame.
+        // translations[ joint ] holds the joint's x y z at each frame, and so on.
+        std::vector< std::vector< float > > translations( num_joints ), rotations( num_joints ), scalings( num_joints );
+        for( int frame = 0; frame < clip.frames; ++frame ) {
+            sampler.sample( std::min( frame / frames_per_second, clip.duration_seconds ), local_transformations );
+            accumulate_transformations( hierarchy, local_transformations, global_transformations );
+            
+            for( int joint = 0; joint < num_joints; ++joint ) {
+                const int node = joint_nodes[ joint ];
+                const aiMatrix4x4& local = pose.parents[ joint ] < 0 ? global_transformations[ node ] : local_transformations[ node ];
+                aiVector3D scaling, position;
+                aiQuaternion rotation;
+                local.Decompose( scaling, rotation, position );
+                
+                // q and -q are the same rotation. Keep each key in the previous one's hemisphere, so interpolating takes the short way.
+                std::vector< float >& joint_rotations = rotations[ joint ];
+                if( frame > 0 ) {
+                    const float* previous = &joint_rotations[ 4*( frame - 1 ) ];
+                    if( previous[0]*rotation.x + previous[1]*rotation.y + previous[2]*rotation.z + previous[3]*rotation.w < 0.f ) {
+                        rotation = aiQuaternion( -rotation.w, -rotation.x, -rotation.y, -rotation.z );
+                    }
+                }
+                
+                translations[ joint ].insert( translations[ joint ].end(), { position.x, position.y, position.z } );
+                joint_rotations.insert( joint_rotations.end(), { rotation.x, rotation.y, rotation.z, rotation.w } );
+                scalings[ joint ].insert( scalings[ joint ].end(), { scaling.x, scaling.y, scaling.z } );
+            }
+        }
+        
+        /// Keep only the keys interpolation can't reproduce.
+        clip.joints.resize( num_joints );
+        parallel_for( num_joints, clamp_threads( num_threads, num_joints ), [&]( int joint, int ) {
+            bake_track( translations[ joint ], clip.frames, 3, tolerance, false, clip.joints[ joint ].translation );
+            bake_track( rotations[ joint ], clip.frames, 4, tolerance, true, clip.joints[ joint ].rotation );
+            bake_track( scalings[ joint ], clip.frames, 3, tolerance, false, clip.joints[ joint ].scaling );
+        } );
+        
+        clips_out.push_back( std::move( clip ) );
+    }
+    
+    return true;
+}
+
+void save_animations_to_ANIM( std::ostream& out, const std::vector< AnimationClip >& clips, int joints ) {
+    /*
+    Writes the baked `clips` of a skeleton with `joints` joints to `out` as a compact binary stream.
+    All numbers are little-endian, and every track starts at a multiple of 4 bytes.
+    
+    ANIM format:
+        A 16-byte header:
+            char[4] magic: "ANIM"
+            uint32 version: 1
+            uint32 joints
+            uint32 clips
+        Then each clip:
+            uint32 name_bytes, and the name's bytes, padded with zeros to a multiple of 4
+            float32 duration, in seconds
+            float32 frames_per_second
+            uint32 frames
+            For each joint (in the TGF's order), its translation, rotation, and scaling tracks, each:
+                uint32 keys
+                uint16 frame of each key (increasing, starting at 0), padded with zeros to a multiple of 4 bytes
+                Each key's value: 3 float32s for translations and scalings,
+                    4 int16s (x y z w, each the component times 32767) for rotations.
+    A joint's transformation at a frame is translation * rotation * scaling, each interpolated
+    linearly between the keys around the frame (rotations normalized afterwards) and held after the last key.
+    It is relative to the joint's parent joint or, for a root, to the scene (as with --matrices).
+    */
+    
+    std::string bytes;
+    auto put = [&]( const void* data, size_t size ) { bytes.append( static_cast< const char* >( data ), size ); };
+    auto put_uint32 = [&]( uint32_t value ) { put( &value, sizeof( value ) ); };
+    auto put_float = [&]( float value ) { put( &value, sizeof( value ) ); };
+    auto pad = [&]() { bytes.append( ( 4 - bytes.size() % 4 ) % 4, '\0' ); };
+    
+    put( "ANIM", 4 );
+    put_uint32( 1 );
+    put_uint32( joints );
+    put_uint32( clips.size() );
+    
+    for( const auto& clip : clips ) {
+        assert( int( clip.joints.size() ) == joints );
+        
+        put_uint32( clip.name.size() );
+        put( clip.name.data(), clip.name.size() );
+        pad();
+        put_float( clip.duration_seconds );
+        put_float( clip.frames_per_second );
+        put_uint32( clip.frames );
+        
+        for( const auto& tracks : clip.joints ) {
+            for( const AnimationClip::Track* track : { &tracks.translation, &tracks.rotation, &tracks.scaling } ) {
+                put_uint32( track->frames.size() );
+                put( track->frames.data(), track->frames.size() * sizeof( uint16_t ) );
+                pad();
+                put( track->values.data(), track->values.size() * sizeof( float ) );
+                put( track->rotations.data(), track->rotations.size() * sizeof( int16_t ) );
+            }
+        }
+    }
+    
+    out.write( bytes.data(), bytes.size() );
+}
+#endif
+
+struct Options
+{
+    // Save the skin weights as sparse (row, column, weight) triplets instead of a dense matrix.
+    bool sparse_weights = false;
+    // Save the skin weights in DMAT's binary variant instead of as text.
+    bool binary_weights = false;
+    // Write the dense skin weights one bone column at a time instead of building the whole matrix first.
+    bool stream_weights = false;
+    // Save one row of skin weights per distinct vertex position of each mesh, plus a table from each exported vertex to its row.
+    bool weld = false;
+    // Save the skeleton and skin weights in one binary .rig file (see rig_file.h) instead of .tgf and .dmat files.
+    bool container = false;
+    // Save the skin weights as the largest this many per vertex, quantized, in a .skin file (0 means don't).
+    int influences = 0;
+    // The bits of each quantized weight in the .skin file: 8 or 16.
+    int weight_bits = 8;
+    // Also save the rest pose: each joint's parent and local transformation, and each bone's inverse bind matrix.
+    bool matrices = false;
+    // Check that the saved rig deforms the meshes like the scene does (see verify_skinning()).
+    bool verify = false;
+    // With verify, fail if the largest skinning error is over this (negative means never fail).
+    double verify_tolerance = -1.;
+    // Bake the animations at this many frames per second into a .anim file (0 means don't).
+    double animation_fps = 0.;
+    // Export the scene, extract the rig, and write each file at the same time.
+    bool concurrent = false;
+    // Only save the rig: don't export the scene, and import only what the rig needs.
+    bool rig_only = false;
+    // The number of threads to extract each file's rig with.
+    int threads = 1;
+    // Treat the paths as a batch of conversions (a manifest or a directory and glob).
+    bool batch = false;
+    // The number of files to convert at once in batch mode (0 means one per core).
+    int jobs = 0;
+    // Record the time and memory of each stage and report them as JSON.
+    bool profile = false;
+    // Where to write the --profile report (empty means stdout).
+    std::string profile_path;
+    // Reuse earlier conversions of identical inputs from this directory (empty means no cache).
+    std::string cache_directory;
+    // Replace existing outputs instead of refusing to convert.
+    bool overwrite = false;
+    // Read the input from stdin and write the outputs to stdout; the input's format (a file extension) if so.
+    std::string pipe_hint;
+    // Run as a daemon converting the jobs dropped into this directory (empty means not a daemon).
+    std::string daemon_directory;
+};
+
+// What --profile records about one conversion.
+struct Profile
+{
+    struct Stage
+    {
+        std::string name;
+        double wall_seconds;
+        double cpu_seconds;
+    };
+    
+    std::string inpath;
+    std::string outpath;
+    bool success = false;
+    std::string error;
+    
+    std::vector< Stage > stages;
+    // Each file written and its size in bytes.
+    std::vector< std::pair< std::string, size_t > > outputs;
+    
+    size_t vertices = 0;
+    size_t joints = 0;
+    size_t bones = 0;
+    // The number of nonzero (vertex, bone) weights.
+    size_t weights = 0;
+    
+    size_t peak_rss_bytes = 0;
+    
+    // With --verify, the skinning error (see SkinningError).
+    double max_skinning_error = 0.;
+    double mean_skinning_error = 0.;
+    int skinning_poses = 0;
+    
+    // The wall time of the whole conversion.
+    // With --concurrent, stages overlap, so it can be less than the sum of their times.
+    double elapsed_seconds = 0.;
+    
+    // With --cache, whether the outputs came from the cache ("hit") or were converted ("miss").
+    std::string cache;
+    
+    void add_output( const std::string& filename ) { outputs.push_back( std::make_pair( filename, os_path_getsize( filename ) ) ); }
+};
+
+namespace
+{
+// Measures the wall time and the process's CPU time (all threads) between laps.
+class StageTimer
+{
+public:
+    StageTimer() { restart(); }
+    
+    // Returns the time since the last lap as `stage`.
+    Profile::Stage lap( const char* stage ) {
+        const Profile::Stage measured = {
+            stage,
+            std::chrono::duration< double >( std::chrono::steady_clock::now() - m_wall_start ).count(),
+            double( std::clock() - m_cpu_start ) / CLOCKS_PER_SEC
+            };
+        restart();
+        return measured;
+    }
+    
+    // If there is a `profile`, records the time since the last lap as `stage`.
+    void lap( Profile* profile, const char* stage ) {
+        const Profile::Stage measured = lap( stage );
+        if( profile ) profile->stages.push_back( measured );
+    }
+    
+    // Starts the next lap now.
+    void restart() {
+        m_wall_start = std::chrono::steady_clock::now();
+        m_cpu_start = std::clock();
+    }
+    
+private:
+    
+    std::chrono::steady_clock::time_point m_wall_start;
+    std::clock_t m_cpu_start;
+};
+
+// The most memory this process has had resident so far, in bytes.
+size_t peak_rss_bytes()
+{
+    struct rusage usage;
+    if( 0 != getrusage( RUSAGE_SELF, &usage ) ) return 0;
+#ifdef __APPLE__
+    // macOS reports bytes.
+    return usage.ru_maxrss;
+#else
+    // Linux reports kilobytes.
+    return size_t( usage.ru_maxrss ) * 1024;
+#endif
+}
+
+std::string json_string( const std::string& str )
+{
+    std::string result( "\"" );
+    for( const char c : str ) {
+        if( c == '"' || c == '\\' ) { result += '\\'; result += c; }
+        else if( c == '\n' ) result += "\\n";
+        else if( c == '\t' ) result += "\\t";
+        else if( (unsigned char)c < 0x20 ) {
+            char escaped[8];
+            snprintf( escaped, sizeof( escaped ), "\\u%04x", c );
+            result += escaped;
+        }
+        else result += c;
+    }
+    result += '"';
+    return result;
+}
+
+void write_profile_JSON( std::ostream& out, const Profile& profile, const Options& options, const std::string& indent = "" )
+{
+    /*
+    Writes `profile` (and the `options` that affect it) as a JSON object.
+    Each line after the first starts with `indent`.
+    */
+    
+    const std::string in = indent + "  ";
+    out << "{\n";
+    out << in << "\"input\": " << json_string( profile.inpath ) << ",\n";
+    out << in << "\"output\": " << json_string( profile.outpath ) << ",\n";
+    out << in << "\"success\": " << ( profile.success ? "true" : "false" ) << ",\n";
+    if( !profile.cache.empty() ) out << in << "\"cache\": " << json_string( profile.cache ) << ",\n";
+    if( !profile.success ) out << in << "\"error\": " << json_string( profile.error ) << ",\n";
+    out << in << "\"options\": { "
+        << "\"sparse\": " << ( options.sparse_weights ? "true" : "false" ) << ", "
+        << "\"binary\": " << ( options.binary_weights ? "true" : "false" ) << ", "
+        << "\"stream\": " << ( options.stream_weights ? "true" : "false" ) << ", "
+        << "\"weld\": " << ( options.weld ? "true" : "false" ) << ", "
+        << "\"container\": " << ( options.container ? "true" : "false" ) << ", "
+        << "\"influences\": " << options.influences << ", "
+        << "\"weight_bits\": " << options.weight_bits << ", "
+        << "\"matrices\": " << ( options.matrices ? "true" : "false" ) << ", "
+        << "\"verify\": " << ( options.verify ? "true" : "false" ) << ", "
+        << "\"animation_fps\": " << options.animation_fps << ", "
+        << "\"concurrent\": " << ( options.concurrent ? "true" : "false" ) << ", "
+        << "\"rig_only\": " << ( options.rig_only ? "true" : "false" ) << ", "
+        << "\"threads\": " << options.threads
+        << " },\n";
+    
+    double total_wall_seconds = 0., total_cpu_seconds = 0.;
+    out << in << "\"stages\": [";
+    for( size_t i = 0; i < profile.stages.size(); ++i ) {
+        const Profile::Stage& stage = profile.stages[i];
+        out << ( i ? "," : "" ) << "\n" << in << "  { \"name\": " << json_string( stage.name )
+            << ", \"wall_seconds\": " << stage.wall_seconds
+            << ", \"cpu_seconds\": " << stage.cpu_seconds << " }";
+        total_wall_seconds += stage.wall_seconds;
+        total_cpu_seconds += stage.cpu_seconds;
+    }
+    out << "\n" << in << "],\n";
+    out << in << "\"total_wall_seconds\": " << total_wall_seconds << ",\n";
+    out << in << "\"total_cpu_seconds\": " << total_cpu_seconds << ",\n";
+    out << in << "\"elapsed_seconds\": " << profile.elapsed_seconds << ",\n";
+    out << in << "\"peak_rss_bytes\": " << profile.peak_rss_bytes << ",\n";
+    out << in << "\"vertices\": " << profile.vertices << ",\n";
+    out << in << "\"joints\": " << profile.joints << ",\n";
+    out << in << "\"bones\": " << profile.bones << ",\n";
+    out << in << "\"weights\": " << profile.weights << ",\n";
+    if( options.verify ) {
+        out << in << "\"skinning_error\": { \"max\": " << profile.max_skinning_error
+            << ", \"mean\": " << profile.mean_skinning_error
+            << ", \"poses\": " << profile.skinning_poses << " },\n";
+    }
+    
+    out << in << "\"outputs\": [";
+    for( size_t i = 0; i < profile.outputs.size(); ++i ) {
+        out << ( i ? "," : "" ) << "\n" << in << "  { \"path\": " << json_string( profile.outputs[i].first )
+            << ", \"bytes\": " << profile.outputs[i].second << " }";
+    }
+    out << "\n" << in << "]\n";
+    out << indent << "}";
+}
+
+FILE* take_stdout()
+{
+    /*
+    Points the stdout file descriptor at stderr, which catches printf() and std::cout from here and from ASSIMP,
+    and returns a stream on the real stdout, or nullptr if it can't.
+    */
+    
+    std::cout.flush();
+    fflush( stdout );
+    const int fd = dup( STDOUT_FILENO );
+    FILE* real_stdout = fd < 0 ? nullptr : fdopen( fd, "wb" );
+    if( nullptr == real_stdout || dup2( STDERR_FILENO, STDOUT_FILENO ) < 0 ) return nullptr;
+    return real_stdout;
+}
+
+// Where save_profile_report() writes a report without a path.
+// main() points it at the real stdout with take_stdout(), so that the report is all that goes there.
+FILE* profile_report_stream = stdout;
+
+bool save_profile_report( const std::string& report, const Options& options )
+{
+    /*
+    Writes `report` to options.profile_path, or to profile_report_stream if there isn't one.
+    */
+    
+    if( options.profile_path.empty() ) {
+        fprintf( profile_report_stream, "%s\n", report.c_str() );
+        fflush( profile_report_stream );
+        return true;
+    }
+    
+    std::ofstream out( options.profile_path );
+    if( !out ) {
+        std::cerr << "ERROR: Unable to open profile report for writing: " << options.profile_path << std::endl;
+        return false;
+    }
+    out << report << '\n';
+    std::cout << "Saved: " << options.profile_path << std::endl;
+    return true;
+}
+}
+
+void usage( const char* argv0, std::ostream& out )
+{
+    out << "Usage: " << argv0 << " [options] path/to/input path/to/output" << std::endl;
+    out << "       " << argv0 << " [options] --batch path/to/manifest" << std::endl;
+    out << "       " << argv0 << " [options] --batch path/to/input_directory 'glob' path/to/output_directory output_extension" << std::endl;
+    out << "       " << argv0 << " [options] --pipe input_extension output_name < input > frames" << std::endl;
+    out << "       " << argv0 << " [options] --daemon path/to/spool_directory" << std::endl;
+    
+    out << std::endl;
+    out << "## Options:\n";
+    out << "--sparse: Save the skin weights as (vertex, bone, weight) triplets in a .sparse.dmat file instead of a dense .dmat file." << std::endl;
+    out << "--binary: Save the skin weights in DMAT's binary variant (raw doubles) instead of as text." << std::endl;
+    out << "--stream: Write the dense skin weights one bone column at a time, without holding the whole matrix in memory." << std::endl;
+    out << "--weld: Save one row of skin weights per distinct vertex position of each mesh, and a .remap.dmat with the row of each exported vertex." << std::endl;
+    out << "--container: Save the skeleton and skin weights (dense, or sparse with --sparse) in one binary .rig file, memory-mappable with rig_file.h." << std::endl;
+    out << "--influences K: Save each vertex's K (at most 16) largest skin weights, normalized and quantized, with their bones in a binary .skin file instead of a .dmat file." << std::endl;
+    out << "--weight-bits 8|16: The bits of each quantized weight in the .skin file (default: 8)." << std::endl;
+    out << "--matrices: Also save each joint's parent and local rest transformation in a .pose.dmat file and each bone's inverse bind matrix in a .bind.dmat file (or in the .rig file)." << std::endl;
+    out << "--verify[=tolerance]: Check that the saved rig deforms the meshes like the scene does, in the rest pose and sampled animation frames," << std::endl;
+    out << "                      and report the largest and mean error. With a tolerance, fail if the largest error is over it." << std::endl;
+    out << "--animations[=fps]: Also bake each animation at fps frames per second (default: 30) into a compact binary .anim file of the joints' keys." << std::endl;
+    out << "--batch: Convert many files. A manifest has one 'path/to/input path/to/output' pair per line (# starts a comment)." << std::endl;
+    out << "         A directory converts the files in it matching the glob to the output directory with the output extension." << std::endl;
+    out << "--pipe input_extension: Read the input (in the format of input_extension) from stdin and write the outputs, named after output_name," << std::endl;
+    out << "                        to stdout as frames: a 'FILE name size' line and the file's bytes for each, then an 'END' line." << std::endl;
+    out << "--daemon path/to/spool_directory: Keep running and convert each NAME.job file (a manifest) dropped into the directory," << std::endl;
+    out << "                                   reporting in NAME.done or NAME.failed. Stop with SIGINT or SIGTERM." << std::endl;
+    out << "--rig-only: Only save the rig, named after the output path. The scene isn't exported, and only the skeleton, vertex positions, and bones are imported." << std::endl;
+    out << "--concurrent: Export the scene while extracting the rig, and write the rig's files at the same time." << std::endl;
+    out << "--threads N: Extract each file's skin weights and format its text TGF and DMAT files with N threads (default: 1)." << std::endl;
+    out << "--jobs N: In batch or daemon mode, convert N files at once (default: one per core)." << std::endl;
+    out << "--cache path/to/cache_directory: Reuse the outputs of earlier conversions of identical input files (with the same output name and options) by copying them." << std::endl;
+    out << "--overwrite: Replace existing outputs instead of refusing to convert." << std::endl;
+    out << "--profile[=path/to/report.json]: Report the wall and CPU time of each stage, peak memory, rig sizes, and output sizes as JSON" << std::endl;
+    out << "                                 (default: to stdout, with everything else the converter prints on stderr; with --pipe, the path is required)." << std::endl;
+    
+    out << std::endl;
+    print_importers( out );
+    
+    out << std::endl;
+    print_exporters( out );
+}
+
+bool parse_arguments( int argc, char* argv[], Options& options, std::vector< std::string >& paths )
+{
+    /*
+    Fills `options` from the arguments starting with "--" and
+    `paths` with the rest, in order.
+    Returns false if an argument is not a known option.
+    */
+    
+    for( int i = 1; i < argc; ++i ) {
+        const std::string arg( argv[i] );
+        
+        if( arg.compare( 0, 2, "--" ) != 0 ) paths.push_back( arg );
+        else if( arg == "--sparse" ) options.sparse_weights = true;
+        else if( arg == "--binary" ) options.binary_weights = true;
+        else if( arg == "--stream" ) options.stream_weights = true;
+        else if( arg == "--weld" ) options.weld = true;
+        else if( arg == "--container" ) options.container = true;
+        else if( arg == "--matrices" ) options.matrices = true;
+        else if( arg == "--verify" ) options.verify = true;
+        else if( arg == "--animations" ) options.animation_fps = 30.;
+        else if( arg.compare( 0, 13, "--animations=" ) == 0 ) {
+            char* end = nullptr;
+            options.animation_fps = strtod( arg.c_str() + 13, &end );
+            if( end == arg.c_str() + 13 || *end || !( options.animation_fps > 0. ) ) {
+                std::cerr << "ERROR: --animations= needs a positive frame rate: " << arg << std::endl;
+                return false;
+            }
+        }
+        else if( arg.compare( 0, 9, "--verify=" ) == 0 ) {
+            options.verify = true;
+            char* end = nullptr;
+            options.verify_tolerance = strtod( arg.c_str() + 9, &end );
+            if( end == arg.c_str() + 9 || *end || options.verify_tolerance < 0. ) {
+                std::cerr << "ERROR: --verify= needs a tolerance of 0 or more: " << arg << std::endl;
+                return false;
+            }
+        }
+        else if( arg == "--concurrent" ) options.concurrent = true;
+        else if( arg == "--rig-only" ) options.rig_only = true;
+        else if( arg == "--batch" ) options.batch = true;
+        else if( arg == "--pipe" && i+1 < argc ) options.pipe_hint = argv[++i];
+        else if( arg == "--cache" && i+1 < argc ) options.cache_directory = argv[++i];
+        else if( arg == "--daemon" && i+1 < argc ) options.daemon_directory = argv[++i];
+        else if( arg == "--overwrite" ) options.overwrite = true;
+        else if( arg == "--profile" ) options.profile = true;
+        else if( arg.compare( 0, 10, "--profile=" ) == 0 ) {
+            options.profile = true;
+            options.profile_path = arg.substr( 10 );
+        }
+        else if( arg == "--influences" && i+1 < argc ) {
+            options.influences = atoi( argv[++i] );
+            if( options.influences <= 0 || options.influences > kMaxInfluences ) {
+                std::cerr << "ERROR: --influences needs a number from 1 to " << kMaxInfluences << ": " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else if( arg == "--weight-bits" && i+1 < argc ) {
+            options.weight_bits = atoi( argv[++i] );
+            if( 8 != options.weight_bits && 16 != options.weight_bits ) {
+                std::cerr << "ERROR: --weight-bits needs 8 or 16: " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else if( arg == "--threads" && i+1 < argc ) {
+            options.threads = atoi( argv[++i] );
+            if( options.threads <= 0 ) {
+                std::cerr << "ERROR: --threads needs a positive number: " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else if( arg == "--jobs" && i+1 < argc ) {
+            options.jobs = atoi( argv[++i] );
+            if( options.jobs <= 0 ) {
+                std::cerr << "ERROR: --jobs needs a positive number: " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else {
+            std::cerr << "ERROR: Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    
+    if( options.container && ( options.stream_weights || options.influences > 0 ) ) {
+        std::cerr << "ERROR: --container doesn't combine with --stream or --influences." << std::endl;
+        return false;
+    }
+    
+    return true;
+}
+
+const char* IdFromOutputPath( const std::string& outpath, std::string& error )
+{
+    /*
+    Returns the ASSIMP export format id for the extension of `outpath`,
+    or nullptr (and sets `error`) if there isn't one.
+    */
+    
+    /// Get the extension of the output path and its corresponding ASSIMP id.
+    std::string extension = os_path_splitext( outpath ).second;
+    // os_path_splitext.second returns an extension of the form ".obj".
     // We want the substring from position 1 to the end.
     if( extension.size() <= 1 ) {
-        std::cerr << "ERROR: No extension detected on the output path: " << extension << std::endl;
-        usage( argv[0], std::cerr );
+        error = "No extension detected on the output path: " + outpath;
+        return nullptr;
+    }
+    extension = extension.substr(1);
+    
+    const char* exportId = IdFromExtension( extension );
+    // Fail if we couldn't find a corresponding ASSIMP id.
+    if( nullptr == exportId ) {
+        error = "Output extension unsupported: " + extension;
+        return nullptr;
+    }
+    
+    return exportId;
+}
+
+unsigned int prepare_importer( Assimp::Importer& importer, const Options& options )
+{
+    /*
+    Sets the properties of `importer` for `options` and
+    returns the post-processing flags to import with.
+    With options.rig_only, the import keeps only what the rig needs:
+    the node hierarchy, and each mesh's vertex positions and bones
+    (and the animations, with options.verify or options.animation_fps).
+    */
+    
+    if( !options.rig_only ) return 0;
+    
+    // Importers that support these don't read what the rig doesn't need in the first place.
+    importer.SetPropertyBool( AI_CONFIG_IMPORT_FBX_READ_MATERIALS, false );
+    importer.SetPropertyBool( AI_CONFIG_IMPORT_FBX_READ_TEXTURES, false );
+    importer.SetPropertyBool( AI_CONFIG_IMPORT_FBX_READ_LIGHTS, false );
+    importer.SetPropertyBool( AI_CONFIG_IMPORT_FBX_READ_CAMERAS, false );
+    // Checking the rig poses it with the animations.
+    const bool keep_animations = options.verify || options.animation_fps > 0.;
+    importer.SetPropertyBool( AI_CONFIG_IMPORT_FBX_READ_ANIMATIONS, keep_animations );
+    
+    // For the rest, aiProcess_RemoveComponent frees it right after import.
+    importer.SetPropertyInteger( AI_CONFIG_PP_RVC_FLAGS,
+        aiComponent_NORMALS | aiComponent_TANGENTS_AND_BITANGENTS | aiComponent_COLORS | aiComponent_TEXCOORDS |
+        ( keep_animations ? 0 : aiComponent_ANIMATIONS ) | aiComponent_TEXTURES | aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_MATERIALS
+        );
+    return aiProcess_RemoveComponent;
+}
+
+// A file saved by convert_in_memory().
+struct MemoryFile
+{
+    std::string name;
+    std::string data;
+};
+
+namespace
+{
+// Where a conversion saves its files: to disk or, if `memory` isn't null, to memory.
+// If `concurrent`, each file is saved on its own thread, and wait() waits for them.
+class OutputFiles
+{
+public:
+    OutputFiles( std::vector< MemoryFile >* memory, Profile* profile, bool concurrent = false ) : m_memory( memory ), m_profile( profile ), m_concurrent( concurrent ) {}
+    ~OutputFiles() { for( auto& pending : m_pending ) pending.wait(); }
+    
+    // Calls `save_to( out )` with a stream for the file named `filename`,
+    // and records the time it takes as `stage` (unless it's null) in the profile.
+    // Returns false and sets `error` if the file can't be written.
+    // If concurrent, returns right away; whatever `save_to` uses must stay valid until wait().
+    template< typename Save >
+    bool save( const std::string& filename, bool binary, const char* stage, const Save& save_to, std::string& error ) {
+        m_records.push_back( Record() );
+        Record& record = m_records.back();
+        record.filename = filename;
+        record.stage = stage;
+        
+        if( m_concurrent ) {
+            m_pending.push_back( std::async( std::launch::async, [this, &record, binary, save_to]() { run( record, binary, save_to ); } ) );
+            return true;
+        }
+        
+        run( record, binary, save_to );
+        return commit( error );
+    }
+    
+    // Waits for the files being saved concurrently.
+    // Returns false and sets `error` if any of them couldn't be written.
+    bool wait( std::string& error ) {
+        for( auto& pending : m_pending ) pending.get();
+        m_pending.clear();
+        return commit( error );
+    }
+    
+private:
+    struct Record
+    {
+        std::string filename;
+        const char* stage = nullptr;
+        bool success = false;
+        std::string error;
+        // The file's data, if it is saved to memory.
+        std::string data;
+        Profile::Stage measured;
+    };
+    
+    template< typename Save >
+    void run( Record& record, bool binary, const Save& save_to ) {
+        StageTimer timer;
+        if( m_memory ) {
+            std::ostringstream out;
+            save_to( out );
+            record.data = out.str();
+            record.success = true;
+        } else {
+            std::ofstream out( record.filename, binary ? std::ios::binary : std::ios::out );
+            if( !out ) {
+                record.error = "Unable to open file for writing: " + record.filename;
+                return;
+            }
+            save_to( out );
+            out.close();
+            if( !out ) {
+                record.error = "Unable to write: " + record.filename;
+                return;
+            }
+            record.success = true;
+        }
+        record.measured = timer.lap( record.stage ? record.stage : "" );
+    }
+    
+    // Records the saved files in the order they were started, from the calling thread.
+    // Returns false and sets `error` if any of them failed.
+    bool commit( std::string& error ) {
+        bool success = true;
+        for( ; m_committed < m_records.size(); ++m_committed ) {
+            Record& record = m_records[ m_committed ];
+            if( !record.success ) {
+                if( success ) error = record.error;
+                success = false;
+                continue;
+            }
+            
+            if( m_memory ) {
+                if( m_profile ) m_profile->outputs.push_back( std::make_pair( record.filename, record.data.size() ) );
+                m_memory->push_back( MemoryFile{ record.filename, std::move( record.data ) } );
+            } else if( m_profile ) {
+                m_profile->add_output( record.filename );
+            }
+            if( m_profile && record.stage ) m_profile->stages.push_back( record.measured );
+            std::cout << "Saved: " << record.filename << std::endl;
+        }
+        return success;
+    }
+    
+    std::vector< MemoryFile >* m_memory;
+    Profile* m_profile;
+    bool m_concurrent;
+    // A deque, so that records stay put while saves are running.
+    std::deque< Record > m_records;
+    size_t m_committed = 0;
+    std::vector< std::future< void > > m_pending;
+};
+
+#if SAVE_RIG
+bool save_rig_outputs( const aiScene* scene, const std::string& basepath, const Options& options, OutputFiles& outputs, StageTimer& timer, Profile* profile, std::string& error )
+{
+    /*
+    Extracts the rig of `scene` and saves it with `outputs` as `basepath` plus
+    ".tgf" and ".dmat" (or ".sparse.dmat" or ".skin"), ".remap.dmat" when welding,
+    and ".pose.dmat" and ".bind.dmat" with options.matrices,
+    or, with options.container, as `basepath` plus ".rig".
+    With options.animation_fps, also bakes the animations into `basepath` plus ".anim".
+    With options.verify, checks the rig with verify_skinning(),
+    and fails if the error is over options.verify_tolerance (unless it's negative).
+    If `outputs` is concurrent, the files are written at the same time.
+    Returns false and sets `error` on failure.
+    */
+    
+    if( !check_rig( scene, error ) ) return false;
+    
+    std::vector< aiVector3D > joints_out;
+    std::vector< std::pair< int, int > > bones_out;
+    std::vector< int > weld_remap;
+    std::vector< int >* const weld_remap_out = options.weld ? &weld_remap : nullptr;
+    
+    // These must outlive the saves.
+    RigFileWriter writer;
+    SparseWeights sparse_weights_out;
+    std::vector< float > weights_out;
+    Influences influences_out;
+    RestPose rest_pose;
+    std::vector< AnimationClip > clips;
+    
+    if( options.matrices || options.verify ) {
+        save_rest_pose( scene, rest_pose, options.threads );
+        timer.lap( profile, "save_rest_pose" );
+    }
+    
+    if( options.container ) {
+        if( options.sparse_weights ) save_rig_sparse( scene, joints_out, bones_out, sparse_weights_out, options.threads, weld_remap_out );
+        else save_rig( scene, joints_out, bones_out, weights_out, options.threads, weld_remap_out );
+        timer.lap( profile, "save_rig" );
+        
+        writer.add_skeleton( joints_out, bones_out );
+        if( options.sparse_weights ) writer.add_weights( sparse_weights_out );
+        else writer.add_weights( weights_out.size() / bones_out.size(), bones_out.size(), weights_out );
+        if( options.weld ) writer.add( rig_file::kWeldRemap, weld_remap.data(), weld_remap.size(), 1 );
+        if( options.matrices ) writer.add_rest_pose( rest_pose );
+        
+        if( !outputs.save( basepath + ".rig", true, "save_rig_to_container", [&]( std::ostream& out ) { writer.write( out ); }, error ) ) return false;
+    } else if( options.influences > 0 ) {
+        save_rig_influences( scene, joints_out, bones_out, influences_out, options.influences, options.threads, weld_remap_out );
+        timer.lap( profile, "save_rig" );
+        
+        if( !outputs.save( basepath + ".tgf", false, "save_skeleton_to_TGF", [&]( std::ostream& out ) { save_skeleton_to_TGF( out, joints_out, bones_out, options.threads ); }, error ) ) return false;
+        if( !outputs.save( basepath + ".skin", true, "save_influences_to_SKIN", [&]( std::ostream& out ) { save_influences_to_SKIN( out, influences_out, options.weight_bits ); }, error ) ) return false;
+    } else if( options.sparse_weights ) {
+        save_rig_sparse( scene, joints_out, bones_out, sparse_weights_out, options.threads, weld_remap_out );
+        timer.lap( profile, "save_rig" );
+        
+        if( !outputs.save( basepath + ".tgf", false, "save_skeleton_to_TGF", [&]( std::ostream& out ) { save_skeleton_to_TGF( out, joints_out, bones_out, options.threads ); }, error ) ) return false;
+        if( !outputs.save( basepath + ".sparse.dmat", options.binary_weights, "save_weights_to_DMAT", [&]( std::ostream& out ) { save_sparse_weights_to_DMAT( out, sparse_weights_out, options.binary_weights, options.threads ); }, error ) ) return false;
+    } else if( options.stream_weights ) {
+        // Extracting the rig and saving the weights are one stage here,
+        // and the skeleton isn't known until it's done.
+        if( !outputs.save( basepath + ".dmat", options.binary_weights, "save_rig_streaming", [&]( std::ostream& out ) { save_rig_streaming( scene, joints_out, bones_out, out, options.binary_weights, options.threads, weld_remap_out ); }, error ) ) return false;
+        if( !outputs.wait( error ) ) return false;
+        
+        if( !outputs.save( basepath + ".tgf", false, "save_skeleton_to_TGF", [&]( std::ostream& out ) { save_skeleton_to_TGF( out, joints_out, bones_out, options.threads ); }, error ) ) return false;
+    } else {
+        save_rig( scene, joints_out, bones_out, weights_out, options.threads, weld_remap_out );
+        assert( weights_out.size() % bones_out.size() == 0 );
+        timer.lap( profile, "save_rig" );
+        
+        if( !outputs.save( basepath + ".tgf", false, "save_skeleton_to_TGF", [&]( std::ostream& out ) { save_skeleton_to_TGF( out, joints_out, bones_out, options.threads ); }, error ) ) return false;
+        if( !outputs.save( basepath + ".dmat", options.binary_weights, "save_weights_to_DMAT", [&]( std::ostream& out ) { save_weights_to_DMAT( out, weights_out.size() / bones_out.size(), bones_out.size(), weights_out, options.binary_weights, options.threads ); }, error ) ) return false;
+    }
+    
+    // Check the rig while its files are written.
+    SkinningError skinning_error;
+    if( options.verify ) {
+        Influences influences;
+        if( options.influences > 0 ) dequantize_influences( influences_out, options.weight_bits, influences );
+        else if( options.sparse_weights ) influences_from_weights( sparse_weights_out, influences );
+        else if( options.stream_weights ) {
+            // The streamed weights aren't kept, so extract them again (the same matrix, sparsely).
+            std::vector< aiVector3D > joints;
+            std::vector< std::pair< int, int > > bones;
+            SparseWeights weights;
+            save_rig_sparse( scene, joints, bones, weights, options.threads, weld_remap_out ? &weld_remap : nullptr );
+            influences_from_weights( weights, influences );
+        }
+        else influences_from_weights( weights_out.size() / std::max< size_t >( bones_out.size(), 1 ), bones_out.size(), weights_out, influences );
+        
+        verify_skinning( scene, bones_out, rest_pose, influences, weld_remap, skinning_error, 4, options.threads );
+        printf( "# Skinning error: max %g, mean %g over %d poses.\n", skinning_error.max, skinning_error.mean, skinning_error.poses );
+        timer.lap( profile, "verify_skinning" );
+    }
+    
+    if( options.matrices && !options.container ) {
+        if( !outputs.save( basepath + ".pose.dmat", options.binary_weights, "save_rest_pose_to_DMAT", [&]( std::ostream& out ) { save_rest_pose_to_DMAT( out, rest_pose, options.binary_weights ); }, error ) ) return false;
+        if( !outputs.save( basepath + ".bind.dmat", options.binary_weights, "save_inverse_bind_matrices_to_DMAT", [&]( std::ostream& out ) { save_inverse_bind_matrices_to_DMAT( out, rest_pose, options.binary_weights ); }, error ) ) return false;
+    }
+    
+    if( options.animation_fps > 0. ) {
+        if( !save_animations( scene, clips, options.animation_fps, 1e-4f, options.threads, &error ) ) {
+            outputs.wait( error );
+            return false;
+        }
+        timer.lap( profile, "save_animations" );
+        if( !outputs.save( basepath + ".anim", true, "save_animations_to_ANIM", [&]( std::ostream& out ) { save_animations_to_ANIM( out, clips, joints_out.size() ); }, error ) ) return false;
+    }
+    
+    if( options.weld && !options.container ) {
+        if( !outputs.save( basepath + ".remap.dmat", options.binary_weights, "save_weld_remap_to_DMAT", [&]( std::ostream& out ) { save_weld_remap_to_DMAT( out, weld_remap, options.binary_weights ); }, error ) ) return false;
+    }
+    
+    if( profile ) {
+        profile->joints = joints_out.size();
+        profile->bones = bones_out.size();
+        if( options.verify ) {
+            profile->max_skinning_error = skinning_error.max;
+            profile->mean_skinning_error = skinning_error.mean;
+            profile->skinning_poses = skinning_error.poses;
+        }
+        for( int mesh_index = 0; mesh_index < int( scene->mNumMeshes ); ++mesh_index ) {
+            const aiMesh* mesh = scene->mMeshes[ mesh_index ];
+            profile->vertices += mesh->mNumVertices;
+            for( int bone_index = 0; bone_index < int( mesh->mNumBones ); ++bone_index ) {
+                const aiBone* bone = mesh->mBones[ bone_index ];
+                for( int weight_index = 0; weight_index < int( bone->mNumWeights ); ++weight_index ) {
+                    if( 0.f != bone->mWeights[ weight_index ].mWeight ) profile->weights += 1;
+                }
+            }
+        }
+    }
+    
+    if( !outputs.wait( error ) ) return false;
+    
+    if( options.verify_tolerance >= 0. && skinning_error.max > options.verify_tolerance ) {
+        std::ostringstream message;
+        message << "The skinning error " << skinning_error.max << " is over the tolerance " << options.verify_tolerance << '.';
+        error = message.str();
+        return false;
+    }
+    
+    return true;
+}
+#endif
+}
+
+bool convert_through_cache( Assimp::Importer& importer, Assimp::Exporter& exporter, const std::string& inpath, const std::string& outpath, const char* exportId, const Options& options, std::string& error, Profile* profile );
+
+bool convert( Assimp::Importer& importer, Assimp::Exporter& exporter, const std::string& inpath, const std::string& outpath, const char* exportId, const Options& options, std::string& error, Profile* profile = nullptr )
+{
+    /*
+    Converts the file `inpath` to `outpath` with the ASSIMP export format `exportId`
+    and saves its rig next to `outpath`.
+    Uses (and reuses) `importer` and `exporter`, so that each thread can have its own.
+    Returns false and sets `error` on failure.
+    If `profile` isn't null, fills it with the time of each stage,
+    the size of the rig, and the size of each file written.
+    With options.cache_directory, goes through convert_through_cache().
+    With options.concurrent, exports the scene while the rig is extracted and saved,
+    and saves the rig's files at the same time.
+    With options.rig_only, only saves the rig; `exportId` is ignored and nothing is written to `outpath`.
+    */
+    
+    assert( exportId );
+    
+    if( !options.cache_directory.empty() ) return convert_through_cache( importer, exporter, inpath, outpath, exportId, options, error, profile );
+    
+    if( profile ) {
+        profile->inpath = inpath;
+        profile->outpath = outpath;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    StageTimer timer;
+    
+    // Fail if the output path already exists.
+    if( !options.overwrite && !options.rig_only && os_path_exists( outpath ) ) {
+        error = "Output path exists. Not clobbering: " + outpath;
+        return false;
+    }
+    
+    /// Load the scene.
+    const aiScene* scene = importer.ReadFile( inpath.c_str(), prepare_importer( importer, options ) );
+    if( nullptr == scene ) {
+        error = importer.GetErrorString();
+        return false;
+    }
+    std::cout << "Loaded: " << inpath << std::endl;
+    timer.lap( profile, "import" );
+    
+    /// Save the scene.
+    // ASSIMP's exporter doesn't change the scene, so it can run alongside the rig, which only reads it.
+    Profile::Stage export_stage;
+    auto export_scene = [&]() {
+        if( options.rig_only ) return aiReturn_SUCCESS;
+        StageTimer export_timer;
+        const aiReturn result = exporter.Export( scene, exportId, outpath.c_str(), 0 );
+        export_stage = export_timer.lap( "export" );
+        return result;
+    };
+    std::future< aiReturn > exported = std::async( options.concurrent ? std::launch::async : std::launch::deferred, export_scene );
+    // Waits for the export and reports it.
+    auto finish_export = [&]() {
+        const aiReturn result = exported.get();
+        if( aiReturn_SUCCESS != result ) {
+            error = std::string( "Could not save the scene: " ) + ( (aiReturn_OUTOFMEMORY == result) ? "Out of memory" : exporter.GetErrorString() );
+            return false;
+        }
+        if( options.rig_only ) return true;
+        std::cout << "Saved: " << outpath << std::endl;
+        if( profile ) {
+            profile->stages.push_back( export_stage );
+            profile->add_output( outpath );
+        }
+        return true;
+    };
+    if( !options.concurrent ) {
+        if( !finish_export() ) {
+            importer.FreeScene();
+            return false;
+        }
+        timer.restart();
+    }
+    
+#if SAVE_RIG
+    /// Save the rig.
+    {
+        OutputFiles outputs( nullptr, profile, options.concurrent );
+        if( !save_rig_outputs( scene, os_path_splitext( outpath ).first, options, outputs, timer, profile, error ) ) {
+            if( options.concurrent ) exported.wait();
+            importer.FreeScene();
+            return false;
+        }
+    }
+#endif
+    
+    if( options.concurrent && !finish_export() ) {
+        importer.FreeScene();
+        return false;
+    }
+    
+    // Cleanup.
+    importer.FreeScene();
+    
+    if( profile ) {
+        profile->success = true;
+        profile->elapsed_seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+        profile->peak_rss_bytes = peak_rss_bytes();
+    }
+    
+    return true;
+}
+
+namespace
+{
+// The name ASSIMP exports a blob under (AI_BLOBIO_MAGIC in assimp/BlobIOSystem.h).
+// A blob's extra files are named after it, like "$blobfile.mtl".
+const char kBlobFileName[] = "$blobfile";
+
+void rename_blob_references( std::string& data, const std::vector< std::string >& extensions, const std::string& name ) {
+    /*
+    Replaces the references in `data` to the extra blob files with each of `extensions`
+    (like OBJ's "mtllib $blobfile.mtl") with references to `name` with that extension.
+    */
+    
+    for( const auto& extension : extensions ) {
+        const std::string from = std::string( kBlobFileName ) + '.' + extension;
+        const std::string to = name + '.' + extension;
+        for( size_t found = data.find( from ); found != std::string::npos; found = data.find( from, found + to.size() ) ) {
+            data.replace( found, from.size(), to );
+        }
+    }
+}
+}
+
+bool convert_in_memory( Assimp::Importer& importer, Assimp::Exporter& exporter, const void* input, size_t input_size, const std::string& input_hint, const std::string& outname, const char* exportId, const Options& options, std::vector< MemoryFile >& files_out, std::string& error, Profile* profile = nullptr )
+{
+    /*
+    Like convert(), but without touching the file system:
+    reads the input from the `input_size` bytes at `input`,
+    whose format ASSIMP guesses with the help of `input_hint` (a file extension like "fbx"),
+    and appends the outputs to `files_out` instead of writing them.
+    The outputs are named as convert() would name them for the output path `outname`.
+    */
+    
+    assert( exportId );
+    
+    if( profile ) {
+        profile->inpath = "(memory)";
+        profile->outpath = outname;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    StageTimer timer;
+    
+    /// Load the scene.
+    const aiScene* scene = importer.ReadFileFromMemory( input, input_size, prepare_importer( importer, options ), input_hint.c_str() );
+    if( nullptr == scene ) {
+        error = importer.GetErrorString();
+        return false;
+    }
+    std::cout << "Loaded: " << input_size << " bytes" << std::endl;
+    timer.lap( profile, "import" );
+    
+    /// Save the scene.
+    // See convert().
+    Profile::Stage export_stage;
+    auto export_scene = [&]() -> const aiExportDataBlob* {
+        if( options.rig_only ) return nullptr;
+        StageTimer export_timer;
+        const aiExportDataBlob* blob = exporter.ExportToBlob( scene, exportId, 0 );
+        export_stage = export_timer.lap( "export" );
+        return blob;
+    };
+    std::future< const aiExportDataBlob* > exported = std::async( options.concurrent ? std::launch::async : std::launch::deferred, export_scene );
+    // Waits for the export and adds its files.
+    // Formats like OBJ export more than one file. The first blob is the main one,
+    // and the rest are named by the extension ASSIMP would have given them.
+    auto finish_export = [&]() {
+        const aiExportDataBlob* blob = exported.get();
+        if( options.rig_only ) return true;
+        if( nullptr == blob ) {
+            error = std::string( "Could not save the scene: " ) + exporter.GetErrorString();
+            return false;
+        }
+        if( profile ) profile->stages.push_back( export_stage );
+        // The main blob refers to the others by ASSIMP's placeholder name, so point it at their real names.
+        std::vector< std::string > extensions;
+        for( const aiExportDataBlob* extra = blob->next; extra; extra = extra->next ) extensions.push_back( extra->name.C_Str() );
+        for( const aiExportDataBlob* main_blob = blob; blob; blob = blob->next ) {
+            const std::string name = blob == main_blob ? outname : os_path_splitext( outname ).first + '.' + blob->name.C_Str();
+            files_out.push_back( MemoryFile{ name, std::string( static_cast< const char* >( blob->data ), blob->size ) } );
+            if( blob == main_blob ) rename_blob_references( files_out.back().data, extensions, os_path_splitext( os_path_split( outname ).second ).first );
+            if( profile ) profile->outputs.push_back( std::make_pair( name, files_out.back().data.size() ) );
+            std::cout << "Saved: " << name << std::endl;
+        }
+        return true;
+    };
+    if( !options.concurrent ) {
+        if( !finish_export() ) {
+            importer.FreeScene();
+            return false;
+        }
+        timer.restart();
+    }
+    
+    // The rig's files come after the scene's.
+    std::vector< MemoryFile > rig_files;
+#if SAVE_RIG
+    /// Save the rig.
+    {
+        OutputFiles outputs( &rig_files, profile, options.concurrent );
+        if( !save_rig_outputs( scene, os_path_splitext( outname ).first, options, outputs, timer, profile, error ) ) {
+            if( options.concurrent ) exported.wait();
+            importer.FreeScene();
+            return false;
+        }
+    }
+#endif
+    
+    if( options.concurrent && !finish_export() ) {
+        importer.FreeScene();
+        return false;
+    }
+    for( auto& file : rig_files ) files_out.push_back( std::move( file ) );
+    
+    // Cleanup.
+    importer.FreeScene();
+    
+    if( profile ) {
+        profile->success = true;
+        profile->elapsed_seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+        profile->peak_rss_bytes = peak_rss_bytes();
+    }
+    
+    return true;
+}
+
+namespace
+{
+/// XXH64 (https://github.com/Cyan4973/xxHash), a fast non-cryptographic hash.
+const uint64_t kXXH64Prime1 = 11400714785074694791ULL;
+const uint64_t kXXH64Prime2 = 14029467366897019727ULL;
+const uint64_t kXXH64Prime3 = 1609587929392839161ULL;
+const uint64_t kXXH64Prime4 = 9650029242287828579ULL;
+const uint64_t kXXH64Prime5 = 2870177450012600261ULL;
+
+inline uint64_t rotate_left( uint64_t x, int bits ) { return ( x << bits ) | ( x >> ( 64 - bits ) ); }
+inline uint64_t read_uint64( const unsigned char* p ) { uint64_t val; memcpy( &val, p, sizeof( val ) ); return val; }
+inline uint32_t read_uint32( const unsigned char* p ) { uint32_t val; memcpy( &val, p, sizeof( val ) ); return val; }
+
+inline uint64_t xxh64_round( uint64_t accumulator, uint64_t input ) {
+    accumulator += input * kXXH64Prime2;
+    accumulator = rotate_left( accumulator, 31 );
+    return accumulator * kXXH64Prime1;
+}
+
+inline uint64_t xxh64_merge_round( uint64_t accumulator, uint64_t val ) {
+    accumulator ^= xxh64_round( 0, val );
+    return accumulator * kXXH64Prime1 + kXXH64Prime4;
+}
+
+uint64_t xxh64( const void* data, size_t length, uint64_t seed ) {
+    const unsigned char* p = static_cast< const unsigned char* >( data );
+    const unsigned char* const end = p + length;
+    
+    uint64_t hash;
+    if( length >= 32 ) {
+        uint64_t v1 = seed + kXXH64Prime1 + kXXH64Prime2;
+        uint64_t v2 = seed + kXXH64Prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kXXH64Prime1;
+        do {
+            v1 = xxh64_round( v1, read_uint64( p ) ); p += 8;
+            v2 = xxh64_round( v2, read_uint64( p ) ); p += 8;
+            v3 = xxh64_round( v3, read_uint64( p ) ); p += 8;
+            v4 = xxh64_round( v4, read_uint64( p ) ); p += 8;
+        } while( p + 32 <= end );
+        
+        hash = rotate_left( v1, 1 ) + rotate_left( v2, 7 ) + rotate_left( v3, 12 ) + rotate_left( v4, 18 );
+        hash = xxh64_merge_round( hash, v1 );
+        hash = xxh64_merge_round( hash, v2 );
+        hash = xxh64_merge_round( hash, v3 );
+        hash = xxh64_merge_round( hash, v4 );
+    } else {
+        hash = seed + kXXH64Prime5;
+    }
+    
+    hash += length;
+    
+    for( ; p + 8 <= end; p += 8 ) {
+        hash ^= xxh64_round( 0, read_uint64( p ) );
+        hash = rotate_left( hash, 27 ) * kXXH64Prime1 + kXXH64Prime4;
+    }
+    if( p + 4 <= end ) {
+        hash ^= uint64_t( read_uint32( p ) ) * kXXH64Prime1;
+        hash = rotate_left( hash, 23 ) * kXXH64Prime2 + kXXH64Prime3;
+        p += 4;
+    }
+    for( ; p < end; ++p ) {
+        hash ^= *p * kXXH64Prime5;
+        hash = rotate_left( hash, 11 ) * kXXH64Prime1;
+    }
+    
+    hash ^= hash >> 33;
+    hash *= kXXH64Prime2;
+    hash ^= hash >> 29;
+    hash *= kXXH64Prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+bool hash_file( const std::string& path, uint64_t& hash ) {
+    /*
+    Sets `hash` to a hash of the bytes of the file `path`:
+    each large block is hashed with the previous block's hash as its seed.
+    Returns false if the file can't be read.
+    */
+    
+    FILE* file = fopen( path.c_str(), "rb" );
+    if( nullptr == file ) return false;
+    
+    std::vector< char > block( 1 << 22 );
+    hash = 0;
+    size_t size;
+    while( ( size = fread( block.data(), 1, block.size(), file ) ) > 0 ) {
+        hash = xxh64( block.data(), size, hash );
+    }
+    
+    const bool success = !ferror( file );
+    fclose( file );
+    return success;
+}
+
+// Bump this whenever a change to the converter changes its output for the same input and options,
+// so that older cache entries are not reused.
+const int kCacheVersion = 1;
+
+std::string cache_key( uint64_t input_hash, const std::string& outpath, const char* exportId, const Options& options ) {
+    /*
+    Returns the name of the cache entry for converting an input whose bytes hash to `input_hash`.
+    The key also covers everything else that changes the outputs:
+    the output file name, the export format, and the options that change what is written.
+    */
+    
+    std::ostringstream signature;
+    signature
+        << "version " << kCacheVersion
+        << " name " << os_path_split( outpath ).second
+        << " format " << exportId
+        << " sparse " << options.sparse_weights
+        << " binary " << options.binary_weights
+        << " weld " << options.weld
+        << " container " << options.container
+        << " influences " << options.influences
+        << " weight_bits " << options.weight_bits
+        << " matrices " << options.matrices
+        << " animation_fps " << options.animation_fps
+        << " rig_only " << options.rig_only;
+    const std::string signature_string = signature.str();
+    
+    char key[17];
+    snprintf( key, sizeof( key ), "%016llx", (unsigned long long)xxh64( signature_string.data(), signature_string.size(), input_hash ) );
+    return key;
+}
+
+std::vector< std::string > list_directory( const std::string& directory ) {
+    std::vector< std::string > names;
+    DIR* dir = opendir( directory.c_str() );
+    if( nullptr == dir ) return names;
+    while( const dirent* entry = readdir( dir ) ) {
+        const std::string name( entry->d_name );
+        if( name != "." && name != ".." ) names.push_back( name );
+    }
+    closedir( dir );
+    std::sort( names.begin(), names.end() );
+    return names;
+}
+
+void remove_directory( const std::string& directory ) {
+    // Cache entries only contain files.
+    for( const auto& name : list_directory( directory ) ) unlink( ( directory + '/' + name ).c_str() );
+    rmdir( directory.c_str() );
+}
+
+bool copy_file( const std::string& from, const std::string& to ) {
+    /*
+    Makes `to` a copy of `from`.
+    Outputs must never share their data with the cache (as hard links would),
+    since a later conversion writing over an output in place would change the cache entry too.
+    Where the file system supports it (on Linux), the copy is a copy-on-write clone, which is as cheap as a link.
+    */
+    
+#ifdef FICLONE
+    const int from_fd = open( from.c_str(), O_RDONLY );
+    if( from_fd >= 0 ) {
+        const int to_fd = open( to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+        const bool cloned = to_fd >= 0 && 0 == ioctl( to_fd, FICLONE, from_fd );
+        if( to_fd >= 0 ) close( to_fd );
+        close( from_fd );
+        if( cloned ) return true;
+    }
+#endif
+    
+    std::ifstream in( from, std::ios::binary );
+    std::ofstream out( to, std::ios::binary | std::ios::trunc );
+    if( !in || !out ) return false;
+    out << in.rdbuf();
+    return bool( out );
+}
+}
+
+bool convert_through_cache( Assimp::Importer& importer, Assimp::Exporter& exporter, const std::string& inpath, const std::string& outpath, const char* exportId, const Options& options, std::string& error, Profile* profile )
+{
+    /*
+    Like convert(), but first looks in options.cache_directory for the outputs of
+    an earlier conversion of the same input bytes with the same output name, format, and options.
+    If they are there, they are copied next to `outpath`, and nothing is imported or exported.
+    Otherwise, converts into a new cache entry and then copies its outputs.
+    */
+    
+    assert( !options.cache_directory.empty() );
+    
+    if( profile ) {
+        profile->inpath = inpath;
+        profile->outpath = outpath;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    StageTimer timer;
+    
+    uint64_t input_hash;
+    if( !hash_file( inpath, input_hash ) ) {
+        error = "Unable to read the input: " + inpath;
+        return false;
+    }
+    const std::string entry = options.cache_directory + '/' + cache_key( input_hash, outpath, exportId, options );
+    timer.lap( profile, "hash_input" );
+    
+    const bool hit = os_path_isdir( entry );
+    if( profile ) profile->cache = hit ? "hit" : "miss";
+    
+    if( !hit ) {
+        // Convert into a private directory and then move it into place,
+        // so that a half-written or concurrently written entry is never used.
+        mkdir( options.cache_directory.c_str(), 0777 );
+        std::string staging = entry + ".XXXXXX";
+        if( nullptr == mkdtemp( &staging[0] ) ) {
+            error = "Unable to create a directory in the cache: " + options.cache_directory;
+            return false;
+        }
+        
+        Options uncached = options;
+        uncached.cache_directory.clear();
+        Profile convert_profile;
+        const bool success = convert( importer, exporter, inpath, staging + '/' + os_path_split( outpath ).second, exportId, uncached, error, profile ? &convert_profile : nullptr );
+        if( profile ) {
+            profile->stages.insert( profile->stages.end(), convert_profile.stages.begin(), convert_profile.stages.end() );
+            profile->vertices = convert_profile.vertices;
+            profile->joints = convert_profile.joints;
+            profile->bones = convert_profile.bones;
+            profile->weights = convert_profile.weights;
+        }
+        
+        // If another conversion finished the same entry first, its files are just as good.
+        if( !success || ( 0 != rename( staging.c_str(), entry.c_str() ) && !os_path_isdir( entry ) ) ) {
+            remove_directory( staging );
+            if( success ) error = "Unable to add the entry to the cache: " + entry;
+            return false;
+        }
+        if( os_path_isdir( staging ) ) remove_directory( staging );
+        
+        timer.lap( profile, "convert" );
+    }
+    
+    // Copy each file of the entry next to outpath.
+    const std::string output_directory = os_path_split( outpath ).first;
+    for( const auto& name : list_directory( entry ) ) {
+        const std::string destination = output_directory.empty() ? name : output_directory + '/' + name;
+        
+        if( os_path_exists( destination ) ) {
+            if( !options.overwrite ) {
+                error = "Output path exists. Not clobbering: " + destination;
+                return false;
+            }
+            unlink( destination.c_str() );
+        }
+        
+        if( !copy_file( entry + '/' + name, destination ) ) {
+            error = "Unable to copy the cached output: " + destination;
+            return false;
+        }
+        std::cout << "Saved: " << destination << ( hit ? " (cached)" : "" ) << std::endl;
+        if( profile ) profile->add_output( destination );
+    }
+    timer.lap( profile, "copy_cached_outputs" );
+    
+    if( profile ) {
+        profile->success = true;
+        profile->elapsed_seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+        profile->peak_rss_bytes = peak_rss_bytes();
+    }
+    
+    return true;
+}
+
+namespace
+{
+struct BatchJob
+{
+    std::string inpath;
+    std::string outpath;
+    // If not empty, why the job can't be converted (like a malformed manifest line), and it fails without converting.
+    std::string error;
+};
+
+bool read_batch_manifest( const std::string& path, std::vector< BatchJob >& jobs, std::string& error )
+{
+    /*
+    Appends to `jobs` a job for each line of the manifest file `path`.
+    Each line is "path/to/input path/to/output". Empty lines and lines starting with '#' are skipped.
+    A line that isn't a job becomes a job named "path:line_number" that fails with an error,
+    so that it is reported like any other failure and doesn't stop the other jobs.
+    Returns false (and sets `error`) if the file can't be read.
+    */
+    
+    std::ifstream in( path );
+    if( !in ) {
+        error = "Unable to open batch manifest: " + path;
+        return false;
+    }
+    
+    std::string line;
+    int line_number = 0;
+    while( std::getline( in, line ) ) {
+        ++line_number;
+        
+        const std::string::size_type first = line.find_first_not_of( " \t\r" );
+        if( first == std::string::npos || line[ first ] == '#' ) continue;
+        
+        std::istringstream words( line );
+        BatchJob job;
+        std::string extra;
+        if( !( words >> job.inpath >> job.outpath ) || ( words >> extra ) ) {
+            job.inpath = path + ':' + std::to_string( line_number );
+            job.outpath.clear();
+            job.error = "Batch manifest line " + std::to_string( line_number ) + " is not 'path/to/input path/to/output': " + line;
+        }
+        jobs.push_back( job );
+    }
+    
+    return true;
+}
+
+bool list_batch_directory( const std::string& input_directory, const std::string& glob, const std::string& output_directory, const std::string& output_extension, std::vector< BatchJob >& jobs )
+{
+    /*
+    Appends to `jobs` a job for each file in `input_directory` whose name matches `glob`.
+    Each output goes in `output_directory`, with the input's name but `output_extension`.
+    */
+    
+    DIR* dir = opendir( input_directory.c_str() );
+    if( nullptr == dir ) {
+        std::cerr << "ERROR: Unable to open batch input directory: " << input_directory << std::endl;
+        return false;
+    }
+    
+    std::vector< std::string > names;
+    while( const dirent* entry = readdir( dir ) ) {
+        if( 0 == fnmatch( glob.c_str(), entry->d_name, 0 ) ) names.push_back( entry->d_name );
+    }
+    closedir( dir );
+    
+    // readdir() order is arbitrary.
+    std::sort( names.begin(), names.end() );
+    
+    std::string extension = output_extension;
+    if( !extension.empty() && extension[0] != '.' ) extension = '.' + extension;
+    
+    for( const auto& name : names ) {
+        BatchJob job;
+        job.inpath = input_directory + '/' + name;
+        if( os_path_isdir( job.inpath ) ) continue;
+        job.outpath = output_directory + '/' + os_path_splitext( name ).first + extension;
+        jobs.push_back( job );
+    }
+    
+    return true;
+}
+}
+
+int run_batch( const std::vector< std::string >& paths, const Options& options )
+{
+    /*
+    Converts every job described by `paths` (a manifest, or a directory, glob,
+    output directory, and output extension) on a pool of worker threads,
+    each with its own importer and exporter.
+    A failed file is reported and doesn't stop the others.
+    Returns 0 if every file converted.
+    */
+    
+    std::vector< BatchJob > jobs;
+    if( 1 == paths.size() ) {
+        std::string error;
+        if( !read_batch_manifest( paths[0], jobs, error ) ) {
+            std::cerr << "ERROR: " << error << std::endl;
+            return -1;
+        }
+    } else if( 4 == paths.size() ) {
+        if( !list_batch_directory( paths[0], paths[1], paths[2], paths[3], jobs ) ) return -1;
+    } else {
         return -1;
     }
-    extension = extension.substr(1);
     
-    const char* exportId = IdFromExtension( extension );
-    // Exit if we couldn't find a corresponding ASSIMP id.
+    // Look up the export format id once per distinct extension.
+    // With --rig-only, there is no export format.
+    std::map< std::string, const char* > extension_to_id;
+    std::vector< const char* > export_ids( jobs.size(), options.rig_only ? "" : nullptr );
+    std::vector< std::string > errors( jobs.size() );
+    for( size_t i = 0; i < jobs.size(); ++i ) {
+        if( !jobs[i].error.empty() ) {
+            export_ids[i] = nullptr;
+            errors[i] = jobs[i].error;
+            continue;
+        }
+        if( options.rig_only ) continue;
+        
+        const std::string extension = os_path_splitext( jobs[i].outpath ).second;
+        const auto found = extension_to_id.find( extension );
+        if( found != extension_to_id.end() && found->second ) export_ids[i] = found->second;
+        else if( found == extension_to_id.end() ) {
+            export_ids[i] = extension_to_id[ extension ] = IdFromOutputPath( jobs[i].outpath, errors[i] );
+        }
+        else errors[i] = "Output extension unsupported: " + extension;
+    }
+    
+    const int num_workers = std::max( 1, std::min( int( jobs.size() ),
+        options.jobs > 0 ? options.jobs : int( std::thread::hardware_concurrency() ) ) );
+    std::cout << "# Converting " << jobs.size() << " files with " << num_workers << " workers." << std::endl;
+    
+    const auto start = std::chrono::steady_clock::now();
+    
+    std::atomic< size_t > next_job( 0 );
+    std::atomic< int > num_failed( 0 );
+    std::atomic< size_t > input_bytes( 0 );
+    std::mutex report_mutex;
+    std::vector< Profile > profiles( options.profile ? jobs.size() : 0 );
+    
+    auto worker = [&]() {
+        Assimp::Importer importer;
+        Assimp::Exporter exporter;
+        
+        for( size_t i = next_job++; i < jobs.size(); i = next_job++ ) {
+            const BatchJob& job = jobs[i];
+            
+            Profile* profile = options.profile ? &profiles[i] : nullptr;
+            
+            bool success = false;
+            if( export_ids[i] ) success = convert( importer, exporter, job.inpath, job.outpath, export_ids[i], options, errors[i], profile );
+            if( profile && !success ) {
+                profile->inpath = job.inpath;
+                profile->outpath = job.outpath;
+                profile->error = errors[i];
+            }
+            
+            if( success ) input_bytes += os_path_getsize( job.inpath );
+            else {
+                ++num_failed;
+                std::lock_guard< std::mutex > lock( report_mutex );
+                std::cerr << "ERROR: " << job.inpath << ": " << errors[i] << std::endl;
+            }
+        }
+    };
+    
+    std::vector< std::thread > workers;
+    for( int i = 0; i < num_workers; ++i ) workers.emplace_back( worker );
+    for( auto& thread : workers ) thread.join();
+    
+    const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+    const int num_converted = int( jobs.size() ) - num_failed;
+    
+    std::cout << "# Converted " << num_converted << " of " << jobs.size() << " files";
+    if( num_failed > 0 ) std::cout << " (" << num_failed << " failed)";
+    std::cout << " in " << seconds << " s: "
+        << ( seconds > 0 ? num_converted / seconds : 0. ) << " files/s, "
+        << ( seconds > 0 ? input_bytes / seconds / ( 1024*1024 ) : 0. ) << " MB/s of input." << std::endl;
+    
+    if( options.profile ) {
+        // With more than one job at a time, CPU times and peak memory are for the whole process.
+        std::ostringstream report;
+        report << "{\n  \"files\": [";
+        for( size_t i = 0; i < profiles.size(); ++i ) {
+            report << ( i ? "," : "" ) << "\n    ";
+            write_profile_JSON( report, profiles[i], options, "    " );
+        }
+        report << "\n  ],\n";
+        report << "  \"jobs\": " << num_workers << ",\n";
+        report << "  \"converted\": " << num_converted << ",\n";
+        report << "  \"failed\": " << num_failed << ",\n";
+        report << "  \"wall_seconds\": " << seconds << ",\n";
+        report << "  \"files_per_second\": " << ( seconds > 0 ? num_converted / seconds : 0. ) << ",\n";
+        report << "  \"input_bytes\": " << input_bytes << ",\n";
+        report << "  \"peak_rss_bytes\": " << peak_rss_bytes() << "\n";
+        report << "}";
+        if( !save_profile_report( report.str(), options ) ) return -1;
+    }
+    
+    return 0 == num_failed ? 0 : -1;
+}
+
+namespace
+{
+bool write_frames( FILE* out, const std::vector< MemoryFile >& files )
+{
+    /*
+    Writes `files` to `out` as one stream. Each file is a line "FILE name size"
+    followed by exactly `size` bytes of data. The stream ends with the line "END".
+    The name is everything between "FILE " and the last space of the line.
+    */
+    
+    for( const auto& file : files ) {
+        fprintf( out, "FILE %s %zu\n", file.name.c_str(), file.data.size() );
+        fwrite( file.data.data(), 1, file.data.size(), out );
+    }
+    fprintf( out, "END\n" );
+    return 0 == fflush( out ) && !ferror( out );
+}
+}
+
+int run_pipe( const std::string& outname, const Options& options )
+{
+    /*
+    Reads the input from stdin, converts it in memory, and writes
+    the outputs to stdout as frames (see write_frames()).
+    Nothing is read from or written to disk (except a --profile report given a path).
+    Everything else the conversion prints goes to stderr, so that stdout carries only the frames.
+    */
+    
+    // Keep the real stdout for the frames; everything else goes to stderr.
+    FILE* frames = take_stdout();
+    if( nullptr == frames ) {
+        std::cerr << "ERROR: Unable to redirect stdout." << std::endl;
+        return -1;
+    }
+    
+    std::string error;
+    // With --rig-only, there is no export format.
+    const char* exportId = options.rig_only ? "" : IdFromOutputPath( outname, error );
     if( nullptr == exportId ) {
-        std::cerr << "ERROR: Output extension unsupported: " << extension << std::endl;
-        usage( argv[0], std::cerr );
+        std::cerr << "ERROR: " << error << std::endl;
         return -1;
     }
     
-    /// Load the scene.
-    const aiScene* scene = aiImportFile( inpath, 0 );
-    if( nullptr == scene ) {
-        std::cerr << "ERROR: " << aiGetErrorString() << std::endl;
-        usage( argv[0], std::cerr );
+    /// Read all of stdin.
+    std::vector< char > input;
+    {
+        const size_t kBlockSize = 1 << 20;
+        size_t size = 0;
+        do {
+            input.resize( size + kBlockSize );
+            size += fread( input.data() + size, 1, kBlockSize, stdin );
+        } while( size == input.size() );
+        input.resize( size );
+    }
+    if( ferror( stdin ) || input.empty() ) {
+        std::cerr << "ERROR: No input on stdin." << std::endl;
         return -1;
     }
-    std::cout << "Loaded: " << inpath << std::endl;
     
-    /// Save the scene.
-    const aiReturn result = aiExportScene( scene, exportId, outpath, 0 );
-    if( aiReturn_SUCCESS != result ) {
-        std::cerr << "ERROR: Could not save the scene: " << ( (aiReturn_OUTOFMEMORY == result) ? "Out of memory" : "Unknown reason" ) << std::endl;
-        usage( argv[0], std::cerr );
+    // ASSIMP wants the hint without the dot.
+    std::string hint = options.pipe_hint;
+    if( !hint.empty() && hint[0] == '.' ) hint = hint.substr(1);
+    
+    Assimp::Importer importer;
+    Assimp::Exporter exporter;
+    Profile profile;
+    std::vector< MemoryFile > files;
+    const bool success = convert_in_memory( importer, exporter, input.data(), input.size(), hint, outname, exportId, options, files, error, options.profile ? &profile : nullptr );
+    
+    if( options.profile ) {
+        if( !success ) profile.error = error;
+        std::ostringstream report;
+        write_profile_JSON( report, profile, options );
+        if( !save_profile_report( report.str(), options ) ) return -1;
+    }
+    
+    if( !success ) {
+        std::cerr << "ERROR: " << error << std::endl;
         return -1;
     }
-    std::cout << "Saved: " << outpath << std::endl;
     
-#if SAVE_RIG
-    /// Save the rig.
+    if( !write_frames( frames, files ) ) {
+        std::cerr << "ERROR: Unable to write to stdout." << std::endl;
+        return -1;
+    }
+    fclose( frames );
+    
+    return 0;
+}
+
+namespace
+{
+volatile std::sig_atomic_t daemon_stop_requested = 0;
+
+void request_daemon_stop( int )
+{
+    daemon_stop_requested = 1;
+}
+
+// How long the daemon sleeps when it finds no new jobs (or no room for them) before looking again.
+const int kDaemonPollMilliseconds = 10;
+
+// What a daemon appends to a job's name when it claims it: ".working." and its process id,
+// so that it's clear which daemon each claimed job belongs to.
+std::string daemon_claim_extension( pid_t pid )
+{
+    return ".working." + std::to_string( pid );
+}
+
+// If `path` is a job claimed by a daemon (NAME.working.PID), sets `base` to NAME and `pid` to PID and returns true.
+bool parse_daemon_claim( const std::string& path, std::string& base, pid_t& pid )
+{
+    const auto base_and_pid = os_path_splitext( path );
+    if( base_and_pid.second.size() < 2 ) return false;
+    const std::string digits = base_and_pid.second.substr( 1 );
+    if( digits.find_first_not_of( "0123456789" ) != std::string::npos ) return false;
+    
+    const auto base_and_extension = os_path_splitext( base_and_pid.first );
+    if( base_and_extension.second != ".working" ) return false;
+    
+    base = base_and_extension.first;
+    pid = pid_t( atol( digits.c_str() ) );
+    return pid > 0;
+}
+
+void run_daemon_job( Assimp::Importer& importer, Assimp::Exporter& exporter, const std::string& base, const Options& options )
+{
+    /*
+    Converts the files of the job `base` claimed by this process (`base`.working.PID, a batch manifest)
+    and replaces it with `base`.done, or `base`.failed if any file failed.
+    The status file has a line per file: "ok path/to/input path/to/output seconds" or "error path/to/input: message".
+    With options.profile, `base`.json gets the profile of each file first.
+    */
+    
+    const auto start = std::chrono::steady_clock::now();
+    const std::string name = os_path_split( base ).second;
+    const std::string claimed_path = base + daemon_claim_extension( getpid() );
+    
+    std::ostringstream status;
+    int num_converted = 0;
+    int num_failed = 0;
+    std::vector< Profile > profiles;
+    
+    std::vector< BatchJob > jobs;
+    std::string error;
+    if( !read_batch_manifest( claimed_path, jobs, error ) ) {
+        status << "error " << name << ".job: " << error << '\n';
+        ++num_failed;
+    }
+    
+    for( const BatchJob& job : jobs ) {
+        const auto job_start = std::chrono::steady_clock::now();
+        
+        Profile profile;
+        // With --rig-only, there is no export format.
+        const char* exportId = nullptr;
+        if( !job.error.empty() ) error = job.error;
+        else exportId = options.rig_only ? "" : IdFromOutputPath( job.outpath, error );
+        const bool success = nullptr != exportId && convert( importer, exporter, job.inpath, job.outpath, exportId, options, error, options.profile ? &profile : nullptr );
+        
+        if( success ) {
+            const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - job_start ).count();
+            status << "ok " << job.inpath << ' ' << job.outpath << ' ' << seconds << '\n';
+            ++num_converted;
+        } else {
+            ++num_failed;
+            status << "error " << job.inpath << ": " << error << '\n';
+            std::cerr << "ERROR: " << job.inpath << ": " << error << std::endl;
+        }
+        
+        if( options.profile ) {
+            if( !success ) {
+                profile.inpath = job.inpath;
+                profile.outpath = job.outpath;
+                profile.error = error;
+            }
+            profiles.push_back( profile );
+        }
+    }
+    
+    if( options.profile ) {
+        std::ofstream report( base + ".json" );
+        report << "{\n  \"files\": [";
+        for( size_t i = 0; i < profiles.size(); ++i ) {
+            report << ( i ? "," : "" ) << "\n    ";
+            write_profile_JSON( report, profiles[i], options, "    " );
+        }
+        report << "\n  ]\n}\n";
+    }
+    
+    // Write the status under a temporary name and rename it into place,
+    // so that whoever waits for it never reads it half-written.
+    const std::string status_path = base + ( 0 == num_failed ? ".done" : ".failed" );
     {
-        std::vector< aiVector3D > joints_out;
-        std::vector< std::pair< int, int > > bones_out;
-        std::vector< float > weights_out;
-        save_rig( scene, joints_out, bones_out, weights_out );
-        assert( weights_out.size() % bones_out.size() == 0 );
+        std::ofstream out( base + ".status" );
+        out << status.str();
+    }
+    if( 0 != rename( ( base + ".status" ).c_str(), status_path.c_str() ) ) {
+        std::cerr << "ERROR: Unable to write the job status: " << status_path << std::endl;
+    }
+    unlink( claimed_path.c_str() );
+    
+    const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+    printf( "# Job %s: converted %d of %d files in %g s.\n", name.c_str(), num_converted, int( jobs.size() ), seconds );
+    fflush( stdout );
+}
+}
+
+int run_daemon( const Options& options )
+{
+    /*
+    Converts the jobs dropped into options.daemon_directory until SIGINT or SIGTERM.
+    A job is a file NAME.job holding a batch manifest (see read_batch_manifest()). To submit one,
+    write it under another name and rename it to NAME.job, so that it is never read half-written.
+    The daemon claims a job by renaming it to NAME.working.PID, with its process id,
+    and replaces it with NAME.done or NAME.failed (see run_daemon_job()).
+    Several daemons on the same machine can serve one directory. At startup, a daemon requeues
+    only the claimed jobs whose daemon is no longer running, so it never takes a job from another daemon.
+    
+    Jobs run on a pool of worker threads, each of which keeps its importer and exporter for every job,
+    and export format ids are looked up once per extension, so a small job costs milliseconds
+    instead of the startup of a process.
+    Jobs are only claimed while the queue has room, so a flood of jobs waits in the directory rather than in memory.
+    */
+    
+    const std::string& directory = options.daemon_directory;
+    if( !os_path_isdir( directory ) ) {
+        std::cerr << "ERROR: The daemon directory doesn't exist: " << directory << std::endl;
+        return -1;
+    }
+    
+    // Requeue the jobs claimed by a daemon that stopped before finishing them.
+    // A daemon that's still running keeps its jobs. If our process id is on a claim,
+    // the daemon that made it is gone and the id was reused.
+    const pid_t pid = getpid();
+    for( const auto& name : list_directory( directory ) ) {
+        std::string base;
+        pid_t owner = 0;
+        if( !parse_daemon_claim( directory + '/' + name, base, owner ) ) continue;
+        const bool owner_running = owner != pid && ( 0 == kill( owner, 0 ) || EPERM == errno );
+        if( !owner_running ) rename( ( base + daemon_claim_extension( owner ) ).c_str(), ( base + ".job" ).c_str() );
+    }
+    const std::string claim_extension = daemon_claim_extension( pid );
+    
+    const int num_workers = std::max( 1, options.jobs > 0 ? options.jobs : int( std::thread::hardware_concurrency() ) );
+    // Besides the jobs being converted, at most this many are claimed and waiting.
+    const size_t queue_capacity = num_workers;
+    
+    std::mutex queue_mutex;
+    std::condition_variable has_work;
+    std::condition_variable has_room;
+    std::deque< std::string > queue;
+    bool stopping = false;
+    
+    auto worker = [&]() {
+        Assimp::Importer importer;
+        Assimp::Exporter exporter;
+        
+        while( true ) {
+            std::string base;
+            {
+                std::unique_lock< std::mutex > lock( queue_mutex );
+                has_work.wait( lock, [&]() { return !queue.empty() || stopping; } );
+                // When stopping, finish the claimed jobs first.
+                if( queue.empty() ) return;
+                base = queue.front();
+                queue.pop_front();
+            }
+            has_room.notify_one();
+            
+            run_daemon_job( importer, exporter, base, options );
+        }
+    };
+    
+    std::vector< std::thread > workers;
+    for( int i = 0; i < num_workers; ++i ) workers.emplace_back( worker );
+    
+    daemon_stop_requested = 0;
+    std::signal( SIGINT, request_daemon_stop );
+    std::signal( SIGTERM, request_daemon_stop );
+    
+    printf( "# Daemon watching %s with %d workers.\n", directory.c_str(), num_workers );
+    fflush( stdout );
+    
+    while( !daemon_stop_requested ) {
+        bool claimed = false;
         
-        std::string filename = os_path_splitext( outpath ).first + ".tgf";
-        save_skeleton_to_TGF( filename, joints_out, bones_out );
-        std::cout << "Saved: " << filename << std::endl;
+        // list_directory() sorts the names, so jobs are claimed in name order.
+        for( const auto& name : list_directory( directory ) ) {
+            const auto base_and_extension = os_path_splitext( directory + '/' + name );
+            if( base_and_extension.second != ".job" ) continue;
+            const std::string& base = base_and_extension.first;
+            
+            // Back-pressure: wait for room in the queue (but not past a stop request).
+            {
+                std::unique_lock< std::mutex > lock( queue_mutex );
+                while( queue.size() >= queue_capacity && !daemon_stop_requested ) {
+                    has_room.wait_for( lock, std::chrono::milliseconds( kDaemonPollMilliseconds ) );
+                }
+            }
+            if( daemon_stop_requested ) break;
+            
+            // If the rename fails, another daemon claimed the job or it was withdrawn.
+            if( 0 != rename( ( base + ".job" ).c_str(), ( base + claim_extension ).c_str() ) ) continue;
+            unlink( ( base + ".done" ).c_str() );
+            unlink( ( base + ".failed" ).c_str() );
+            
+            {
+                std::lock_guard< std::mutex > lock( queue_mutex );
+                queue.push_back( base );
+            }
+            has_work.notify_one();
+            claimed = true;
+        }
         
-        filename = os_path_splitext( outpath ).first + ".dmat";
-        save_weights_to_DMAT( filename, weights_out.size() / bones_out.size(), bones_out.size(), weights_out );
-        std::cout << "Saved: " << filename << std::endl;
+        if( !claimed ) std::this_thread::sleep_for( std::chrono::milliseconds( kDaemonPollMilliseconds ) );
     }
-#endif
     
-    // Cleanup.
-    aiReleaseImport( scene );
+    printf( "# Daemon stopping after the claimed jobs.\n" );
+    fflush( stdout );
+    {
+        std::lock_guard< std::mutex > lock( queue_mutex );
+        stopping = true;
+    }
+    has_work.notify_all();
+    for( auto& thread : workers ) thread.join();
+    
+    return 0;
+}
+
+// Define CONVERTER_NO_MAIN to include this file in another program (like bench.cpp) for its functions.
+#ifndef CONVERTER_NO_MAIN
+int main( int argc, char* argv[] )
+{
+    Options options;
+    std::vector< std::string > paths;
+    if( !parse_arguments( argc, argv, options, paths ) ) {
+        usage( argv[0], std::cerr );
+        return -1;
+    }
+    
+    // A --profile report on stdout must be all that is there, so send everything else to stderr.
+    // (Pipe mode does this itself and needs a path for the report, and the daemon writes a report for each job.)
+    if( options.profile && options.profile_path.empty() && options.pipe_hint.empty() && options.daemon_directory.empty() ) {
+        profile_report_stream = take_stdout();
+        if( nullptr == profile_report_stream ) {
+            std::cerr << "ERROR: Unable to redirect stdout." << std::endl;
+            return -1;
+        }
+    }
+    
+    if( options.batch ) {
+        /// We need a manifest or a directory, glob, output directory, and output extension.
+        if( 1 != paths.size() && 4 != paths.size() ) {
+            usage( argv[0], std::cerr );
+            return -1;
+        }
+        return run_batch( paths, options );
+    }
+    
+    if( !options.daemon_directory.empty() ) {
+        /// The jobs come from the daemon directory.
+        if( !paths.empty() || options.batch || !options.pipe_hint.empty() ) {
+            usage( argv[0], std::cerr );
+            return -1;
+        }
+        return run_daemon( options );
+    }
+    
+    if( !options.pipe_hint.empty() ) {
+        /// We need the output name.
+        if( 1 != paths.size() ) {
+            usage( argv[0], std::cerr );
+            return -1;
+        }
+        // Stdout carries the frames, so the report needs a file.
+        if( options.profile && options.profile_path.empty() ) {
+            std::cerr << "ERROR: --profile needs a path with --pipe, like --profile=report.json." << std::endl;
+            return -1;
+        }
+        return run_pipe( paths[0], options );
+    }
+    
+    /// We need two paths: the input path and the output path.
+    if( 2 != paths.size() ) {
+        usage( argv[0], std::cerr );
+        return -1;
+    }
+    
+    /// Store the input and output paths.
+    const std::string& inpath = paths[0];
+    const std::string& outpath = paths[1];
+    
+    // Exit if the output path already exists.
+    if( !options.overwrite && !options.rig_only && os_path_exists( outpath ) ) {
+        std::cerr << "ERROR: Output path exists. Not clobbering: " << outpath << std::endl;
+        usage( argv[0], std::cerr );
+        return -1;
+    }
+    
+    std::string error;
+    // With --rig-only, there is no export format.
+    const char* exportId = options.rig_only ? "" : IdFromOutputPath( outpath, error );
+    // Exit if we couldn't find a corresponding ASSIMP id.
+    if( nullptr == exportId ) {
+        std::cerr << "ERROR: " << error << std::endl;
+        usage( argv[0], std::cerr );
+        return -1;
+    }
+    
+    Assimp::Importer importer;
+    Assimp::Exporter exporter;
+    Profile profile;
+    const bool success = convert( importer, exporter, inpath, outpath, exportId, options, error, options.profile ? &profile : nullptr );
+    
+    if( options.profile ) {
+        if( !success ) profile.error = error;
+        std::ostringstream report;
+        write_profile_JSON( report, profile, options );
+        if( !save_profile_report( report.str(), options ) ) return -1;
+    }
+    
+    if( !success ) {
+        std::cerr << "ERROR: " << error << std::endl;
+        usage( argv[0], std::cerr );
+        return -1;
+    }
     
     return 0;
 }
+#endif
@@ -0,0 +1,257 @@
+// rig_file.h: A header-only reader for the .rig files written by `converter --container`.
+// It memory-maps the file and hands out typed spans that point straight into it,
+// so loading a rig copies and parses nothing.
+//
+// Usage:
+//     rig_file::RigFile rig;
+//     std::string error;
+//     if( !rig.open( "Bob.rig", &error ) ) { ... }
+//     rig_file::Span< float > joints = rig.joints(); // 3 by #joints: the x y z of each joint together
+//     for( size_t i = 0; i < joints.cols; ++i ) { float x = joints( 0, i ); ... }
+//
+// Format (all numbers little-endian):
+//     Header (48 bytes):
+//         char[8] magic: "RIGFILE\0"
+//         uint32 version: 1
+//         uint32 header_size: 48
+//         uint32 section_count
+//         uint32 vertices: the rows of the weight matrix
+//         uint32 joints
+//         uint32 bones
+//         uint64 file_size
+//         uint64 reserved: 0
+//     Section table, right after the header: section_count entries of (24 bytes):
+//         uint32 tag: four characters, like 'JNTS'
+//         uint32 type: 1 for float32, 2 for int32
+//         uint64 offset: from the start of the file, a multiple of 64
+//         uint32 rows
+//         uint32 cols
+//     Then the sections' data, each rows*cols values stored column-major.
+// Readers skip sections with tags they don't know, so new sections can be added without a new version.
+
+#ifndef RIG_FILE_H
+#define RIG_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring> // memcmp
+#include <string>
+
+#include <fcntl.h> // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h> // close
+
+namespace rig_file
+{
+const char kMagic[8] = { 'R', 'I', 'G', 'F', 'I', 'L', 'E', '\0' };
+const uint32_t kVersion = 1;
+// Every section starts at a multiple of this many bytes.
+const uint64_t kAlignment = 64;
+
+enum Type : uint32_t
+{
+    kFloat32 = 1,
+    kInt32 = 2
+};
+
+constexpr uint32_t make_tag( char a, char b, char c, char d ) {
+    return uint32_t( uint8_t( a ) ) | ( uint32_t( uint8_t( b ) ) << 8 ) | ( uint32_t( uint8_t( c ) ) << 16 ) | ( uint32_t( uint8_t( d ) ) << 24 );
+}
+
+// The position of each joint: 3 by #joints float32, so each joint's x y z are together.
+const uint32_t kJoints = make_tag( 'J', 'N', 'T', 'S' );
+// The start and end joints of each bone, 0-indexed: 2 by #bones int32, so each bone's pair is together.
+const uint32_t kBones = make_tag( 'B', 'O', 'N', 'E' );
+// The parent joint of each joint, or -1 for a root: #joints by 1 int32. Parents come before their children.
+const uint32_t kParents = make_tag( 'P', 'R', 'N', 'T' );
+// The dense weight matrix: #vertices by #bones float32.
+const uint32_t kDenseWeights = make_tag( 'W', 'D', 'N', 'S' );
+// The sparse weight matrix in compressed sparse column form: the nonzeros of bone `c` are
+// [ column_starts[c], column_starts[c+1] ) of the rows and values.
+// Column starts: #bones+1 by 1 int32. Rows: #nonzeros by 1 int32. Values: #nonzeros by 1 float32.
+const uint32_t kSparseWeightColumnStarts = make_tag( 'W', 'C', 'O', 'L' );
+const uint32_t kSparseWeightRows = make_tag( 'W', 'R', 'O', 'W' );
+const uint32_t kSparseWeightValues = make_tag( 'W', 'V', 'A', 'L' );
+// With welding, the weight row of each exported vertex: #exported vertices by 1 int32.
+const uint32_t kWeldRemap = make_tag( 'W', 'M', 'A', 'P' );
+// With --matrices, each joint's rest transformation relative to its parent joint (or to the scene, for a root):
+// 16 by #joints float32, each column a row-major 4x4 matrix.
+const uint32_t kRestPose = make_tag( 'R', 'E', 'S', 'T' );
+// With --matrices, each bone's inverse bind matrix (from mesh space to its end joint's space): 16 by #bones float32, like kRestPose.
+const uint32_t kInverseBindMatrices = make_tag( 'I', 'B', 'N', 'D' );
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t section_count;
+    uint32_t vertices;
+    uint32_t joints;
+    uint32_t bones;
+    uint64_t file_size;
+    uint64_t reserved;
+};
+static_assert( sizeof( Header ) == 48, "rig_file::Header must match the file layout." );
+
+struct Section
+{
+    uint32_t tag;
+    uint32_t type;
+    uint64_t offset;
+    uint32_t rows;
+    uint32_t cols;
+};
+static_assert( sizeof( Section ) == 24, "rig_file::Section must match the file layout." );
+
+template< typename T > struct TypeOf;
+template<> struct TypeOf< float > { static const uint32_t value = kFloat32; };
+template<> struct TypeOf< int32_t > { static const uint32_t value = kInt32; };
+
+// A view of a section's values. It points into the mapped file, so it is valid as long as the RigFile is open.
+template< typename T >
+struct Span
+{
+    const T* data = nullptr;
+    size_t rows = 0;
+    size_t cols = 0;
+    
+    size_t size() const { return rows * cols; }
+    bool empty() const { return 0 == size(); }
+    const T* begin() const { return data; }
+    const T* end() const { return data + size(); }
+    const T& operator[]( size_t i ) const { return data[i]; }
+    // Sections are column-major.
+    const T& operator()( size_t row, size_t col ) const { return data[ col * rows + row ]; }
+};
+
+class RigFile
+{
+public:
+    RigFile() {}
+    ~RigFile() { close(); }
+    RigFile( const RigFile& ) = delete;
+    RigFile& operator=( const RigFile& ) = delete;
+    
+    // Maps the file `path` and checks its header and section table.
+    // Returns false (and sets `*error` if it isn't null) if it can't.
+    bool open( const char* path, std::string* error = nullptr ) {
+        close();
+        
+        const int fd = ::open( path, O_RDONLY );
+        if( fd < 0 ) return fail( error, std::string( "Unable to open: " ) + path );
+        struct stat info;
+        if( 0 != fstat( fd, &info ) || info.st_size <= 0 ) {
+            ::close( fd );
+            return fail( error, std::string( "Unable to read: " ) + path );
+        }
+        void* mapped = mmap( nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        // The mapping keeps the file alive.
+        ::close( fd );
+        if( MAP_FAILED == mapped ) return fail( error, std::string( "Unable to map: " ) + path );
+        
+        m_mapped = mapped;
+        m_mapped_size = info.st_size;
+        if( !use( mapped, info.st_size, error ) ) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    
+    // Uses the `size` bytes at `data` (which must stay valid and be 8-byte aligned) as the file,
+    // for rigs already in memory. Returns false (and sets `*error`) if they aren't a valid file.
+    bool attach( const void* data, size_t size, std::string* error = nullptr ) {
+        close();
+        if( !use( data, size, error ) ) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    
+    void close() {
+        if( m_mapped ) munmap( m_mapped, m_mapped_size );
+        m_mapped = nullptr;
+        m_mapped_size = 0;
+        m_data = nullptr;
+        m_size = 0;
+    }
+    
+    bool is_open() const { return nullptr != m_data; }
+    
+    const Header& header() const { return *reinterpret_cast< const Header* >( m_data ); }
+    const Section* sections() const { return reinterpret_cast< const Section* >( m_data + header().header_size ); }
+    
+    // The section with `tag`, or null if there isn't one.
+    const Section* find( uint32_t tag ) const {
+        for( uint32_t i = 0; i < header().section_count; ++i ) {
+            if( sections()[i].tag == tag ) return &sections()[i];
+        }
+        return nullptr;
+    }
+    bool has( uint32_t tag ) const { return nullptr != find( tag ); }
+    
+    // The values of the section with `tag`, or an empty span if there isn't one or its values aren't `T`s.
+    template< typename T >
+    Span< T > section( uint32_t tag ) const {
+        Span< T > span;
+        const Section* found = find( tag );
+        if( nullptr == found || found->type != TypeOf< T >::value ) return span;
+        span.data = reinterpret_cast< const T* >( m_data + found->offset );
+        span.rows = found->rows;
+        span.cols = found->cols;
+        return span;
+    }
+    
+    Span< float > joints() const { return section< float >( kJoints ); }
+    Span< int32_t > bones() const { return section< int32_t >( kBones ); }
+    Span< int32_t > parents() const { return section< int32_t >( kParents ); }
+    // Empty unless the weights are dense.
+    Span< float > dense_weights() const { return section< float >( kDenseWeights ); }
+    // Empty unless the weights are sparse.
+    Span< int32_t > sparse_weight_column_starts() const { return section< int32_t >( kSparseWeightColumnStarts ); }
+    Span< int32_t > sparse_weight_rows() const { return section< int32_t >( kSparseWeightRows ); }
+    Span< float > sparse_weight_values() const { return section< float >( kSparseWeightValues ); }
+    // Empty unless the rig was welded.
+    Span< int32_t > weld_remap() const { return section< int32_t >( kWeldRemap ); }
+    // Empty unless the rig was saved with --matrices.
+    Span< float > rest_pose() const { return section< float >( kRestPose ); }
+    Span< float > inverse_bind_matrices() const { return section< float >( kInverseBindMatrices ); }
+    
+private:
+    // Checks that the `size` bytes at `data` are a valid file and uses them.
+    bool use( const void* data, size_t size, std::string* error ) {
+        m_data = static_cast< const unsigned char* >( data );
+        m_size = size;
+        
+        if( size < sizeof( Header ) ) return fail( error, "Too small to be a rig file." );
+        const Header& header = this->header();
+        if( 0 != memcmp( header.magic, kMagic, sizeof( kMagic ) ) ) return fail( error, "Not a rig file." );
+        if( header.version != kVersion ) return fail( error, "Unsupported rig file version: " + std::to_string( header.version ) );
+        if( header.header_size < sizeof( Header ) || header.header_size > size || header.file_size != size ) return fail( error, "Corrupt rig file header." );
+        if( header.section_count > ( size - header.header_size ) / sizeof( Section ) ) return fail( error, "Corrupt rig file section table." );
+        
+        for( uint32_t i = 0; i < header.section_count; ++i ) {
+            const Section& section = sections()[i];
+            const uint64_t bytes = uint64_t( section.rows ) * section.cols * 4;
+            if( section.offset % kAlignment != 0 || section.offset > size || bytes > size - section.offset ) return fail( error, "Corrupt rig file section." );
+        }
+        
+        return true;
+    }
+    
+    static bool fail( std::string* error, const std::string& message ) {
+        if( error ) *error = message;
+        return false;
+    }
+    
+    void* m_mapped = nullptr;
+    size_t m_mapped_size = 0;
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+};
+}
+
+#endif